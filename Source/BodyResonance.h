@@ -0,0 +1,235 @@
+//
+//  BodyResonance.h
+//  KarplusStrong
+//
+//  An instrument body or speaker cabinet, convolved with the summed output of all the
+//  strings rather than with each voice, so its cost doesn't grow with polyphony.
+//
+//  The impulse responses are modelled rather than recorded: a few damped resonant modes
+//  over a decaying noise tail. The audio thread only records which body is wanted; a
+//  background thread notices the change, generates the response and hands it to
+//  juce::dsp::Convolution, which resamples and partitions it on its own thread and
+//  crossfades to it.
+//
+//  When to crossfade then depends on thread timing, so offline renders load the response
+//  on the audio thread instead and install it before the block, without a crossfade. Those
+//  renders come out the same every time.
+//
+
+#ifndef BodyResonance_h
+#define BodyResonance_h
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class BodyResonance : private juce::Thread {
+public:
+    enum Body { off, acoustic, parlour, cabinet };
+
+    // zeroLatency convolves a short head partition at the block size and the rest in
+    // longer ones. lowCpu uses long uniform partitions and delays the output by one.
+    enum class Partitioning { zeroLatency, lowCpu };
+
+    static const juce::StringArray& bodyNames() {
+        static const juce::StringArray names { "Off", "Acoustic", "Parlour", "Cabinet" };
+        return names;
+    }
+
+    BodyResonance(): juce::Thread("KarplusStrong body") {}
+
+    ~BodyResonance() override {
+        stopThread(1000);
+    }
+
+    // Not real-time safe. Rebuilds the convolution if the partitioning has changed, and
+    // installs the requested body if it isn't loaded already.
+    void prepare(double sampleRate, int maxBlockSize, int numChannels, Partitioning newPartitioning) {
+        stopThread(1000);
+        if (convolution == nullptr || newPartitioning != partitioning) {
+            partitioning = newPartitioning;
+            if (partitioning == Partitioning::zeroLatency)
+                convolution = std::make_unique<juce::dsp::Convolution>(juce::dsp::Convolution::NonUniform { headSize });
+            else
+                convolution = std::make_unique<juce::dsp::Convolution>(juce::dsp::Convolution::Latency { lowCpuPartitionSize });
+            loadedBody = off;
+        }
+        spec = { sampleRate, (juce::uint32) maxBlockSize, (juce::uint32) numChannels };
+        loadRequestedBody();
+        // Runs the pending load and installs its result straight away
+        convolution->prepare(spec);
+        installedBody = loadedBody;
+        latency = convolution->getLatency();
+        dryDelay.setMaximumDelayInSamples(juce::jmax(1, latency));
+        dryDelay.prepare(spec);
+        dryDelay.setDelay((float) latency);
+        wet.setSize(numChannels, maxBlockSize);
+        mix.reset(sampleRate, 0.05);
+        mix.setCurrentAndTargetValue(mix.getTargetValue());
+        convolving = false;
+        startThread(juce::Thread::Priority::low);
+    }
+
+    // Samples the output is delayed by. Fixed by the partitioning, whether or not a body
+    // is on, so switching one in doesn't move anything in time.
+    int getLatency() const {
+        return latency;
+    }
+
+    // Audio thread. A new body's response is built in the background, with the previous
+    // one sounding until it is ready - unless nonRealtime, when it is built and installed
+    // here, which isn't real-time safe. amount crossfades from dry (0) to all body (1).
+    void setBody(int newBody, float amount, bool nonRealtime) {
+        loadingHere.store(nonRealtime);
+        requestedBody.store(newBody);
+        if (nonRealtime && newBody != off && convolution != nullptr) {
+            const juce::ScopedLock sl(loadLock);
+            if (newBody != installedBody) {
+                load(newBody);
+                convolution->prepare(spec);
+                installedBody = newBody;
+                convolving = false;
+            }
+        }
+        mix.setTargetValue(newBody == off ? 0.0f : amount);
+    }
+
+    void process(juce::AudioBuffer<float>& buffer, int numSamples) {
+        juce::dsp::AudioBlock<float> dryBlock(buffer);
+        auto dry = dryBlock.getSubBlock(0, (size_t) numSamples);
+        if (! mix.isSmoothing() && mix.getTargetValue() == 0.0f) {
+            convolving = false;
+            if (latency > 0)
+                dryDelay.process(juce::dsp::ProcessContextReplacing<float>(dry));
+            return;
+        }
+
+        // Coming back on, so the convolution's history is stale
+        if (! convolving) {
+            convolution->reset();
+            convolving = true;
+        }
+        auto numChannels = juce::jmin(buffer.getNumChannels(), wet.getNumChannels());
+        for (int channel = 0; channel < numChannels; channel++)
+            wet.copyFrom(channel, 0, buffer, channel, 0, numSamples);
+        juce::dsp::AudioBlock<float> wetBlock(wet);
+        auto wetSamples = wetBlock.getSubBlock(0, (size_t) numSamples);
+        convolution->process(juce::dsp::ProcessContextReplacing<float>(wetSamples));
+        if (latency > 0)
+            dryDelay.process(juce::dsp::ProcessContextReplacing<float>(dry));
+
+        for (int i = 0; i < numSamples; i++) {
+            auto amount = mix.getNextValue();
+            for (int channel = 0; channel < numChannels; channel++) {
+                auto* out = buffer.getWritePointer(channel);
+                out[i] += amount * (wet.getReadPointer(channel)[i] - out[i]);
+            }
+        }
+    }
+
+private:
+    static constexpr int headSize = 256;
+    static constexpr int lowCpuPartitionSize = 2048;
+    static constexpr double referenceSampleRate = 48000.0;
+    static constexpr int loadPollMilliseconds = 50;
+
+    struct Mode {
+        float frequency;
+        float decaySeconds;
+        float gain;
+    };
+
+    struct Model {
+        float lengthSeconds;
+        std::vector<Mode> modes;
+        float noiseDecaySeconds;
+        float noiseCutoffHz;
+        float noiseGain;
+    };
+
+    static const Model& modelFor(int body) {
+        static const std::vector<Model> models {
+            { 0.0f, {}, 0.0f, 0.0f, 0.0f },
+            { 0.35f, { { 98.0f, 0.12f, 1.0f }, { 204.0f, 0.08f, 0.8f }, { 225.0f, 0.07f, 0.6f },
+                       { 390.0f, 0.05f, 0.5f }, { 480.0f, 0.04f, 0.4f } }, 0.06f, 4000.0f, 0.5f },
+            { 0.25f, { { 150.0f, 0.08f, 1.0f }, { 280.0f, 0.06f, 0.8f }, { 420.0f, 0.04f, 0.6f },
+                       { 610.0f, 0.03f, 0.4f } }, 0.04f, 5000.0f, 0.5f },
+            { 0.03f, { { 110.0f, 0.01f, 0.6f }, { 2500.0f, 0.004f, 0.5f } }, 0.004f, 4500.0f, 1.0f },
+        };
+        return models[(size_t) juce::jlimit(0, (int) models.size() - 1, body)];
+    }
+
+    // Stereo, at referenceSampleRate. Each channel has its own mode phases and noise, for width.
+    static juce::AudioBuffer<float> makeImpulseResponse(int body) {
+        auto& model = modelFor(body);
+        auto length = juce::jmax(1, (int) (model.lengthSeconds * referenceSampleRate));
+        juce::AudioBuffer<float> response(2, length);
+        auto noiseCoefficient = 1.0f - std::exp(-juce::MathConstants<float>::twoPi * model.noiseCutoffHz
+                                                / (float) referenceSampleRate);
+        for (int channel = 0; channel < 2; channel++) {
+            juce::Random random(body * 2 + channel);
+            std::vector<float> phases;
+            for (size_t mode = 0; mode < model.modes.size(); mode++)
+                phases.push_back(random.nextFloat() * juce::MathConstants<float>::twoPi);
+            auto* out = response.getWritePointer(channel);
+            float noise = 0.0f;
+            for (int i = 0; i < length; i++) {
+                auto t = (float) (i / referenceSampleRate);
+                float sample = 0.0f;
+                for (size_t mode = 0; mode < model.modes.size(); mode++) {
+                    auto& m = model.modes[mode];
+                    sample += m.gain * std::exp(-t / m.decaySeconds)
+                              * std::sin(juce::MathConstants<float>::twoPi * m.frequency * t + phases[mode]);
+                }
+                noise += noiseCoefficient * (2.0f * random.nextFloat() - 1.0f - noise);
+                out[i] = sample + model.noiseGain * std::exp(-t / model.noiseDecaySeconds) * noise;
+            }
+        }
+        return response;
+    }
+
+    void run() override {
+        while (! threadShouldExit()) {
+            if (! loadingHere.load()) {
+                const juce::ScopedLock sl(loadLock);
+                loadRequestedBody();
+            }
+            wait(loadPollMilliseconds);
+        }
+    }
+
+    // With loadLock held, or the thread stopped
+    void loadRequestedBody() {
+        auto body = requestedBody.load();
+        if (body != off && body != loadedBody && convolution != nullptr)
+            load(body);
+    }
+
+    // Queues body's response; the convolution crossfades to it once it is built, or
+    // installs it at once on its next prepare()
+    void load(int body) {
+        convolution->loadImpulseResponse(makeImpulseResponse(body), referenceSampleRate,
+                                         juce::dsp::Convolution::Stereo::yes,
+                                         juce::dsp::Convolution::Trim::no,
+                                         juce::dsp::Convolution::Normalise::yes);
+        loadedBody = body;
+        installedBody = off;
+    }
+
+    std::unique_ptr<juce::dsp::Convolution> convolution;
+    juce::dsp::ProcessSpec spec {};
+    Partitioning partitioning = Partitioning::zeroLatency;
+    juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> dryDelay;
+    juce::AudioBuffer<float> wet;
+    juce::SmoothedValue<float> mix { 0.0f };
+    std::atomic<int> requestedBody { off };
+    std::atomic<bool> loadingHere { false };   // set while rendering offline
+    juce::CriticalSection loadLock;
+    int loadedBody = off;      // the last body queued, under loadLock
+    int installedBody = off;   // and the last installed without a crossfade
+    int latency = 0;
+    bool convolving = false;
+};
+
+#endif /* BodyResonance_h */
@@ -0,0 +1,173 @@
+//
+//  ExcitationCache.h
+//  KarplusStrong
+//
+//  Precomputed string excitations, so starting a note is a bulk copy into the string
+//  rather than generating noise and comb filtering it one sample at a time.
+//
+//  A few banks of white noise long enough for the lowest note are made when the synth
+//  is prepared. From those, a background thread builds a table of picked excitations -
+//  noise through the pick position comb filter - for every note's loop length at the
+//  current (quantised) pick position, and publishes it atomically. Note-ons read the
+//  published table; if it doesn't match yet they do the comb filter with vector ops
+//  straight from the noise, which gives exactly the same result.
+//
+
+#ifndef ExcitationCache_h
+#define ExcitationCache_h
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <vector>
+#include "Utils.h"
+#include "Tuning.h"
+
+class ExcitationCache: private juce::Thread {
+public:
+    static constexpr int numNoiseBanks = 4;
+    static constexpr int pickPositionSteps = 20;
+    static constexpr int numNotes = 128;
+
+    ExcitationCache(): juce::Thread("KarplusStrong excitation cache") {}
+
+    ~ExcitationCache() override {
+        stopThread(1000);
+        delete current.load();
+    }
+
+    // Makes the noise banks and the table for the current pick position, then starts the
+    // thread that rebuilds it when the pick position changes. Not real-time safe.
+    void prepare(double newSampleRate, int maxLoopLength) {
+        stopThread(1000);
+        sampleRate = newSampleRate;
+        noiseLength = juce::jmax(1, maxLoopLength);
+        noise.resize((size_t) (numNoiseBanks * noiseLength));
+        FastRandom<8> random(noiseSeed);
+        random.fillBipolar(noise.data(), (int) noise.size());
+        fallback.resize((size_t) noiseLength);
+        publish(buildTable(requestedStep.load()));
+        startThread(juce::Thread::Priority::low);
+    }
+
+    // Safe to call from the audio thread; the table is rebuilt in the background
+    void setPickPosition(float pickPosition) {
+        requestedStep.store(quantise(pickPosition));
+    }
+
+    // Loop length used for an unbent note at the default brightness, matching KsVoice's tuning
+    static int loopLengthFor(int midiNoteNumber, double sampleRate) {
+        auto loopDelay = sampleRate / juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber);
+        return TuningTables::delayFor((float) loopDelay - 0.5f);
+    }
+
+    // White noise through the pick position comb filter. Uses the prebuilt table when it
+    // covers this note and pick position, and filters the noise directly otherwise.
+    // bank and offset pick which noise and how far round it to start, for variety.
+    // Only one thread (the audio thread) may call this.
+    void writePicked(StringBuffer& string, int midiNoteNumber, float pickPosition, int bank, int offset) {
+        auto loopLength = string.getDelay();
+        auto step = quantise(pickPosition);
+        bank %= numNoiseBanks;
+
+        auto* table = current.load();
+        hazard.store(table);
+        if (table != nullptr && table == current.load() && table->pickStep == step
+            && table->length[midiNoteNumber] == loopLength) {
+            auto* excitation = table->data.data() + table->offset[bank][midiNoteNumber];
+            writeRotated(string, excitation, loopLength, offset % loopLength, loopLength);
+        } else {
+            loopLength = juce::jmin(loopLength, noiseLength);
+            filterNoise(fallback.data(), bank, loopLength, step);
+            writeRotated(string, fallback.data(), loopLength, offset % loopLength, loopLength);
+        }
+        hazard.store(nullptr);
+    }
+
+private:
+    struct Table {
+        int pickStep;
+        int length[numNotes];
+        size_t offset[numNoiseBanks][numNotes];
+        std::vector<float> data;
+    };
+
+    static int quantise(float pickPosition) {
+        return juce::roundToInt(juce::jlimit(0.0f, 1.0f, pickPosition) * pickPositionSteps);
+    }
+
+    const float* noiseBank(int bank) const {
+        return noise.data() + (size_t) (bank * noiseLength);
+    }
+
+    // y[n] = x[n] - x[n - d], with d the pick position as a fraction of the loop
+    void filterNoise(float* dest, int bank, int loopLength, int step) const {
+        auto* source = noiseBank(bank);
+        auto delay = juce::roundToInt((float) step / pickPositionSteps * loopLength);
+        if (delay == 0) {
+            juce::FloatVectorOperations::clear(dest, loopLength);
+            return;
+        }
+        juce::FloatVectorOperations::copy(dest, source, loopLength);
+        if (delay < loopLength)
+            juce::FloatVectorOperations::subtract(dest + delay, source, loopLength - delay);
+    }
+
+    static void writeRotated(StringBuffer& string, const float* source, int sourceLength, int offset, int numSamples) {
+        auto firstRun = juce::jmin(numSamples, sourceLength - offset);
+        string.write(source + offset, firstRun, 1);
+        if (firstRun < numSamples)
+            string.write(source, numSamples - firstRun, 1);
+    }
+
+    Table* buildTable(int step) {
+        auto* table = new Table();
+        table->pickStep = step;
+        size_t total = 0;
+        for (int note = 0; note < numNotes; note++) {
+            table->length[note] = juce::jlimit(0, noiseLength, loopLengthFor(note, sampleRate));
+            total += (size_t) table->length[note];
+        }
+        table->data.resize(total * numNoiseBanks);
+        size_t position = 0;
+        for (int bank = 0; bank < numNoiseBanks; bank++) {
+            for (int note = 0; note < numNotes; note++) {
+                table->offset[bank][note] = position;
+                if (table->length[note] > 0)
+                    filterNoise(table->data.data() + position, bank, table->length[note], step);
+                position += (size_t) table->length[note];
+            }
+        }
+        return table;
+    }
+
+    // Swap in a new table, and free the old one once the audio thread isn't reading it
+    void publish(Table* table) {
+        auto* old = current.exchange(table);
+        while (old != nullptr && hazard.load() == old)
+            juce::Thread::sleep(1);
+        delete old;
+    }
+
+    void run() override {
+        while (! threadShouldExit()) {
+            auto step = requestedStep.load();
+            auto* table = current.load();
+            if (table == nullptr || table->pickStep != step)
+                publish(buildTable(step));
+            wait(rebuildPollMilliseconds);
+        }
+    }
+
+    static constexpr int noiseSeed = 0x4b53;
+    static constexpr int rebuildPollMilliseconds = 50;
+
+    double sampleRate = 44100.0;
+    int noiseLength = 0;
+    std::vector<float> noise;
+    std::vector<float> fallback; // sized in prepare, used by the audio thread only
+    std::atomic<int> requestedStep { pickPositionSteps / 2 };
+    std::atomic<Table*> current { nullptr };
+    std::atomic<Table*> hazard { nullptr };
+};
+
+#endif /* ExcitationCache_h */
@@ -10,42 +10,26 @@
 
 #pragma once
 #include <JuceHeader.h>
-using juce::dsp::DelayLine;
+#include "Utils.h"
+#include "ExcitationCache.h"
 using juce::Random;
 
+// Each voice's view of the shared ExcitationCache, with its own choice of noise
 class Exciter {
-    DelayLine<float> delay;
+    ExcitationCache& cache;
     Random rng;
 public:
-    Exciter() {}
-    
-    void prepare(float maxLoopLen, juce::dsp::ProcessSpec spec) {
-        delay.setMaximumDelayInSamples(maxLoopLen);
-        delay.prepare(spec);
-    }
-    
-    // Populate the delay line with plain white noise - this forms the impulse of our note
-    void populateImpulse(DelayLine<float>& previousSampleBuffer) {
-        int loopSize = previousSampleBuffer.getDelay();
-        while (loopSize--) {
-            float sample = (rng.nextFloat() - 0.5) * 2;
-            previousSampleBuffer.pushSample(0, sample);
-        }
+    Exciter(ExcitationCache& cacheToUse): cache(cacheToUse) {}
+
+    // Makes the choice of noise repeatable from here on
+    void setSeed(juce::int64 seed) {
+        rng.setSeed(seed);
     }
     
     // Populate the delay line with white noise pushed through a comb filter
-    void impulsePicked(DelayLine<float>& previousSampleBuffer, float pickPosition) {
+    void impulsePicked(StringBuffer& previousSampleBuffer, int midiNoteNumber, float pickPosition) {
         jassert( 0.0 <= pickPosition && pickPosition <= 1.0);
-        int loopSize = previousSampleBuffer.getDelay();
-        delay.reset();
-        delay.setDelay(pickPosition * loopSize);
-        while (loopSize--) {
-            
-            float sample = (rng.nextFloat() - 0.5) * 2;
-            delay.pushSample(0, sample);
-            sample = sample - delay.popSample(0);
-            previousSampleBuffer.pushSample(0, sample);
-        }
-        
+        cache.writePicked(previousSampleBuffer, midiNoteNumber, pickPosition,
+                          rng.nextInt(ExcitationCache::numNoiseBanks), rng.nextInt(1 << 20));
     }
 };
@@ -8,46 +8,108 @@
 #ifndef Filters_h
 #define Filters_h
 
-class LowPass {
-    float previousSample = 0.0;
-    float probability = 1.0;
-    juce::Random random;
-    
-public:
-    float getNextSample(float currentSample) {
-        float coeff = (random.nextFloat() < probability) ? 0.5 : -0.5;
-        float outputSample = coeff * (currentSample + previousSample);
-        previousSample = currentSample;
-        return outputSample;
-    }
-    
-    void clearState() {
-        previousSample = 0.0;
-    }
-};
+#include <type_traits>
+#include "Utils.h"
+
+// Stages of the string loop as StringBank runs it, templated on the sample type so the same
+// code works on a float or on a SIMD register holding one sample of several strings. A
+// LoopChain picks one stage of each kind at compile time, so every combination becomes its
+// own fused loop with no per-sample dispatch.
+namespace LoopStage {
+    // The plain average when stretch is 0.5; smaller stretch weights the newer sample and
+    // shortens the decay less. Phase delay is about stretch samples.
+    template <typename Value>
+    struct StretchedAverage {
+        Value stretch, previous;
+        Value process(Value x) {
+            auto y = x + (previous - x) * stretch;
+            previous = x;
+            return y;
+        }
+        void ramp(Value step) {
+            stretch += step;
+        }
+    };
+
+    // y[n] = (1 - c) x[n] + c y[n - 1], for damping that can be set anywhere between a
+    // bright and a very dull string
+    template <typename Value>
+    struct OnePoleDamping {
+        Value coefficient, previous;
+        Value process(Value x) {
+            previous = x + (previous - x) * coefficient;
+            return previous;
+        }
+        void ramp(Value step) {
+            coefficient += step;
+        }
+    };
+
+    template <typename Value>
+    struct NoDispersion {
+        Value process(Value x) {
+            return x;
+        }
+    };
 
-class AllPass {
-    float a = 0.5;
-    float previousInput = 0.0;
-    float previousOutput = 0.0;
-public:
-    float getNextOutput(float currentInput) {
-        float outputSample = a * (currentInput - previousOutput) + previousInput;
-        previousOutput = outputSample;
-        previousInput = currentInput;
-        return outputSample;
-    }
-    
-    void updateCoefficient(float phaseDelay, float fundamentalFreq, float sampleFreq) {
-        auto omega_0 = juce::MathConstants<float>::twoPi * fundamentalFreq / sampleFreq;
-        a = sin((1 - phaseDelay) * omega_0 / 2) / sin((1 + phaseDelay) * omega_0 / 2);
-    }
-    
-    void clearState() {
-        previousInput = 0.0;
-        previousOutput = 0.0;
-    }
+    // A cascade of first order allpasses with a negative coefficient delays low partials
+    // more than high ones, so the upper partials come round sharp, as on a stiff string
+    template <typename Value>
+    struct Dispersion {
+        static constexpr int numStages = 4;
+        Value coefficient;
+        Value input[numStages], output[numStages];
+        Value process(Value x) {
+            for (int stage = 0; stage < numStages; stage++) {
+                auto y = coefficient * (x - output[stage]) + input[stage];
+                input[stage] = x;
+                output[stage] = y;
+                x = y;
+            }
+            return x;
+        }
+    };
+
+    template <typename Value>
+    struct FullLevel {
+        Value process(Value x) {
+            return x;
+        }
+    };
+
+    // Outside the loop: mixes the string with a lowpassed copy of itself, so softer notes
+    // (lower level) sound duller as well as quieter
+    template <typename Value>
+    struct DynamicLevel {
+        Value level, coefficient, previous;
+        Value process(Value x) {
+            previous = x + (previous - x) * coefficient;
+            return previous + (x - previous) * level;
+        }
+    };
+}
+
+template <template <typename> class DampingStage, template <typename> class DispersionStage,
+          template <typename> class LevelStage>
+struct LoopChain {
+    static constexpr bool dispersive = ! std::is_same<DispersionStage<float>, LoopStage::NoDispersion<float>>::value;
+    static constexpr bool dynamic = ! std::is_same<LevelStage<float>, LoopStage::FullLevel<float>>::value;
+    template <typename Value> using Damping = DampingStage<Value>;
+    template <typename Value> using Dispersion = DispersionStage<Value>;
+    template <typename Value> using Level = LevelStage<Value>;
 };
 
+// Phase delay in samples of the allpass y = a (x - y[n-1]) + x[n-1] at omega radians
+// per sample. Not for the audio thread's per-sample path.
+inline float allPassPhaseDelay(float coefficient, float omega) {
+    auto phase = std::atan2(-std::sin(omega), coefficient + std::cos(omega))
+               - std::atan2(-coefficient * std::sin(omega), 1.0f + coefficient * std::cos(omega));
+    return -phase / omega;
+}
+
+// Phase delay in samples of the one pole lowpass y = (1 - c) x + c y[n-1] at omega
+inline float onePolePhaseDelay(float coefficient, float omega) {
+    return std::atan2(coefficient * std::sin(omega), 1.0f - coefficient * std::cos(omega)) / omega;
+}
 
 #endif /* Filters_h */
@@ -0,0 +1,745 @@
+//
+//  KsSynthesiser.h
+//  KarplusStrong
+//
+//  The synth's sound, voice and synthesiser classes. Voices handle note allocation,
+//  excitation and tuning; the string loops of all of them are rendered together by a
+//  StringBank. Pitch bend, glide and vibrato retune each string once per block.
+//
+//  MIDI is handled by KsSynthesiser::renderBlock() rather than juce::Synthesiser, which
+//  would split the block at every event. Events take effect at their sample offsets: notes
+//  start and stop inside the block, and bend, pressure and mod wheel moves become ramps
+//  of the loop's allpass and damping coefficients, from the latest such event's offset to
+//  the end of the block. In that block glide and vibrato move over the same stretch.
+//
+//  Pitch bend, channel pressure and timbre (CC74) are kept per MIDI channel, so in MPE mode
+//  (lower zone: master channel 1, notes on 2-16) each note has its own. Events only store
+//  the new value; every sounding voice smooths towards its channel's values once a block.
+//  Bend retunes the loop, pressure brightens the damping filter, and in MPE mode the
+//  timbre when a note starts sets its pick position.
+//
+//  With coupling on, each new note is linked to the strings in tune with it, and those
+//  links are fed after every block by SympatheticStrings (see there).
+//
+//  Notes from the oversampling note up run their strings at 2x, and an octave higher at
+//  4x (see StringBank). They are tuned as the note one or two octaves down, which has the
+//  same loop length at the base rate, and don't take part in coupling. The rest of the
+//  synth's output is delayed to meet them as they come out of the decimators, which
+//  makes getLatencySamples() the synth's latency.
+//
+
+#ifndef KsSynthesiser_h
+#define KsSynthesiser_h
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+#include "Filters.h"
+#include "Utils.h"
+#include "Exciter.h"
+#include "StringBank.h"
+#include "RenderWorkers.h"
+#include "ExcitationCache.h"
+#include "Tuning.h"
+#include "SympatheticStrings.h"
+
+using juce::MidiMessage;
+
+
+// Settings voices read when a note starts and as it plays. Written by the processor on the
+// audio thread before each block, so voices can hold a reference instead of keeping their
+// own copies.
+struct KsNoteParameters {
+    float pickPosition = 0.5f;
+    float stereoSpread = 0.5f;
+    float brightness = 0.0f;
+    bool onePoleDamping = false; // damp with a one pole lowpass rather than the two-tap average
+    float stiffness = 0.0f;      // 0 to 1, how far the partials are stretched sharp
+    float dynamics = 0.0f;       // 0 to 1, how much duller soft notes sound
+    float bendRange = 2.0f;      // semitones at full pitch wheel
+    float glideTime = 0.0f;      // seconds, 0 for none
+    float releaseTime = 0.0f;    // seconds for a released note to fall 60 dB, 0 to stop it at once
+    float vibratoRate = 5.0f;    // Hz
+    float vibratoDepth = 0.5f;   // semitones at full mod wheel
+    float pressureDepth = 0.5f;  // brightness added at full pressure
+    bool mpe = false;            // per-note expression on channels 2-16, with 1 as the master
+    float mpeBendRange = 48.0f;  // semitones at full per-note bend
+    float coupling = 0.0f;       // 0 to 1, how strongly strings in tune ring each other
+    int openStrings = SympatheticStrings::none; // open strings that only ring in sympathy
+    int maxOversampling = 4;     // 1, 2 or 4
+    int oversamplingNote = 84;   // lowest note run at 2x; from an octave above, 4x
+};
+
+// The expression last received on one MIDI channel
+struct KsChannelExpression {
+    float bend = 0.0f;           // -1 to 1
+    float pressure = 0.0f;       // 0 to 1
+    float timbre = 0.5f;         // 0 to 1, from CC74
+    int changedAt = 0;           // offset in the block of its latest bend or pressure event
+};
+
+// Everything a synth's voices share
+struct KsVoiceShared {
+    KsNoteParameters parameters;
+    TuningTables tuning;
+    float modWheel = 0.0f;
+    int modWheelChangedAt = 0;   // offset in the block of its latest move
+    float lastPitch = -1.0f;     // where the next glide starts, or -1 before the first note
+    int eventOffset = 0;         // sample offset in the block of the MIDI event being handled
+    int eventChannel = 1;        // and its channel
+    std::array<KsChannelExpression, 16> channels;
+    float expressionSmoothing = 1.0f; // fraction of the way to its target expression moves each block
+    static constexpr int masterChannel = 1;
+
+    // Seeded rendering: each note's noise comes from the seed, its note, its voice and how
+    // many note-ons came before it, rather than from wherever the voice's generator had got to
+    bool seeded = false;
+    juce::int64 seed = 0;
+    juce::uint32 noteOnCount = 0; // since the seed was set
+
+    // Block statistics for the performance monitor, reset by the synth every block
+    int noteOns = 0;
+    juce::int64 excitationTicks = 0;
+};
+
+struct KsSound: public juce::SynthesiserSound {
+    KsSound() {}
+    bool appliesToNote(int) override {return true;}
+    bool appliesToChannel(int) override {return true;}
+};
+
+class KsVoice: public juce::SynthesiserVoice {
+    KsVoiceShared& shared;
+    StringBank& bank;
+    SympatheticStrings& sympathetic;
+    int stringIndex;
+    StringBuffer previousSamples;
+    StringBuffer retriggerSamples; // the next excitation of a string retriggered while it sounds
+    Exciter exciter;
+    bool retriggering = false;
+    int oversampling = 1;        // the string runs at this many times the sample rate
+
+    // Tuning of the current note
+    float filterDelay = 0.5f;    // phase delay of the loop filters at the fundamental
+    float dispersionDelay = 0.0f; // the stiffness allpasses' part of it
+    float targetPitch = 0.0f;
+    float currentPitch = 0.0f;
+    float glideRate = 0.0f;      // semitones per sample
+    float vibratoPhase = 0.0f;
+
+    // Expression of the current note, smoothed
+    int channel = 1;
+    float bend = 0.0f;           // semitones
+    float pressure = 0.0f;
+    float noteBrightness = 0.0f; // the brightness parameter when the note started
+    float dampingBrightness = 0.0f; // brightness the damping filter is set for
+    int startOffset = 0;         // where in the current block the note started
+
+public:
+    KsVoice(KsVoiceShared& sharedToUse, StringBank& bankToUse, SympatheticStrings& sympatheticToUse,
+            ExcitationCache& excitations, int index)
+        : shared(sharedToUse), bank(bankToUse), sympathetic(sympatheticToUse), stringIndex(index), exciter(excitations) {}
+
+    // Hands the string its two slices of the synth's arena, each sized by maxLoopLengthFor()
+    void setStringStorage(float* loopStorage, float* retriggerStorage, int capacity) {
+        previousSamples.setStorage(loopStorage, capacity);
+        retriggerSamples.setStorage(retriggerStorage, capacity);
+    }
+
+    // Makes the next startNote() pluck the string that is sounding again, rather than
+    // stopping it and starting afresh. For the synth, before it restarts the voice.
+    void prepareRetrigger() {
+        retriggering = true;
+    }
+
+    // Longest loop any note can need: the lowest note, with the lowpass delay at its smallest
+    static int maxLoopLengthFor(double sampleRate) {
+        return (int) std::ceil(sampleRate / MidiMessage::getMidiNoteInHertz(lowestNote));
+    }
+
+    // 1, 2 or 4: how many times the sample rate a note's string runs at. High notes run
+    // faster, where the loop is long enough for the damping filter and the tuning allpass
+    // to behave as they do for lower notes.
+    static int oversamplingFor(const KsNoteParameters& parameters, int midiNoteNumber) {
+        auto factor = midiNoteNumber >= parameters.oversamplingNote + 12 ? 4
+                    : midiNoteNumber >= parameters.oversamplingNote ? 2 : 1;
+        return juce::jmin(factor, juce::jmax(1, parameters.maxOversampling));
+    }
+
+    bool canPlaySound (juce::SynthesiserSound* sound) override {
+        return true;
+    }
+
+    void startNote(int midiNoteNumber, float velocity, juce::SynthesiserSound*, int) override {
+        auto& parameters = shared.parameters;
+        shared.noteOns++;
+        shared.noteOnCount++;
+        if (shared.seeded)
+            exciter.setSeed(noteSeed(midiNoteNumber));
+        if (retriggering) {
+            retrigger(midiNoteNumber, velocity);
+            return;
+        }
+        startOffset = shared.eventOffset;
+        channel = juce::jlimit(1, 16, shared.eventChannel);
+        bend = targetBend();
+        pressure = targetPressure();
+        targetPitch = (float) midiNoteNumber;
+        currentPitch = targetPitch;
+        glideRate = 0.0f;
+        if (parameters.glideTime > 0.0f && shared.lastPitch >= 0.0f) {
+            currentPitch = shared.lastPitch;
+            glideRate = std::abs(targetPitch - currentPitch) / (parameters.glideTime * (float) getSampleRate());
+        }
+        shared.lastPitch = targetPitch;
+        vibratoPhase = 0.0f;
+        oversampling = oversamplingFor(parameters, midiNoteNumber);
+
+        auto pitch = tablePitch(currentPitch + bend);
+        auto period = shared.tuning.periodFor(pitch);
+        auto filters = loopFiltersFor(period, velocity);
+        auto loopLength = period - filterDelay;
+        auto delay = juce::jmin(TuningTables::delayFor(loopLength), previousSamples.getMaximumDelay());
+        auto coefficient = shared.tuning.allPassCoefficientFor(loopLength - (float) delay, pitch);
+        previousSamples.setDelay(delay);
+        auto excitationStart = juce::Time::getHighResolutionTicks();
+        auto pickPosition = parameters.mpe && isMemberChannel() ? shared.channels[(size_t) channel - 1].timbre
+                                                                 : parameters.pickPosition;
+        exciter.impulsePicked(previousSamples, excitationNote(midiNoteNumber), pickPosition);
+        shared.excitationTicks += juce::Time::getHighResolutionTicks() - excitationStart;
+        bank.startString(stringIndex, previousSamples, coefficient, filters, velocity * oversampledGain(),
+                         stereoPositionFor(midiNoteNumber), startOffset, oversampling);
+        // Coupling runs at the base rate, so oversampled strings neither ring nor are rung
+        if (oversampling == 1)
+            sympathetic.addString(stringIndex, previousSamples, targetPitch + bend);
+    }
+
+    // Moves the string's pitch on by a block's worth of glide and vibrato, and smooths the
+    // note's bend and pressure towards their channel's latest values, ramping the allpass
+    // and damping to match from the offset of the block's latest expression event (or its
+    // start, if none). Changes the loop's integer delay only when the
+    // allpass can't cover the move, and then by as little as it can, crossfading the loop's
+    // read tap to it while the allpass ramps to match, so there is no step. The fade lasts
+    // one trip round the loop (or the block, if shorter): midway through a one sample move
+    // the taps average, which dulls the top octave about as much as one more trip through
+    // the damping would, and longer fades compound that. A larger move (a fast glide
+    // across a big block) briefly sums two delays.
+    void updateTuning(int numSamples) {
+        auto& parameters = shared.parameters;
+        auto rampOffset = juce::jmax(startOffset, expressionChangedAt());
+        numSamples -= startOffset;
+        startOffset = 0;
+        bend += (targetBend() - bend) * shared.expressionSmoothing;
+        pressure += (targetPressure() - pressure) * shared.expressionSmoothing;
+        if (currentPitch != targetPitch) {
+            auto step = glideRate * (float) numSamples;
+            currentPitch = currentPitch < targetPitch ? juce::jmin(targetPitch, currentPitch + step)
+                                                      : juce::jmax(targetPitch, currentPitch - step);
+        }
+        vibratoPhase += parameters.vibratoRate * (float) numSamples / (float) getSampleRate();
+        vibratoPhase -= std::floor(vibratoPhase);
+
+        auto pitch = tablePitch(currentPitch + bend
+                                + shared.modWheel * parameters.vibratoDepth * shared.tuning.sineFor(vibratoPhase));
+        auto period = shared.tuning.periodFor(pitch);
+        auto brightness = brightnessFor(pressure);
+        if (std::abs(brightness - dampingBrightness) > brightnessTolerance)
+            setDampingBrightness(brightness, period);
+        auto loopLength = period - filterDelay;
+        auto delay = juce::jmin(TuningTables::delayFor(loopLength, previousSamples.getDelay()),
+                                previousSamples.getMaximumDelay());
+        auto coefficient = shared.tuning.allPassCoefficientFor(loopLength - (float) delay, pitch);
+        // The tap fade starts with the block, so the allpass has to ramp with it
+        if (delay != previousSamples.getDelay()) {
+            previousSamples.fadeToDelay(delay, juce::jmin(numSamples * oversampling, delay));
+            rampOffset = 0;
+        }
+        bank.rampAllPassCoefficient(stringIndex, coefficient);
+        bank.setRampOffset(stringIndex, rampOffset);
+    }
+
+    // For display: numPoints samples spread round the string's loop
+    void readLoop(float* dest, int numPoints) const {
+        previousSamples.readSpread(dest, numPoints);
+    }
+
+    // The string is rendered along with all the others by KsSynthesiser::renderVoices
+    void renderNextBlock(juce::AudioSampleBuffer&, int, int) override {}
+
+    // Called once the bank has found the string inaudible, or to shed it under load
+    void stringDecayed() {
+        clearCurrentNote();
+        sympathetic.removeString(stringIndex);
+        bank.stopString(stringIndex);
+        previousSamples.restart();
+        retriggering = false;
+    }
+
+    // A note-off damps the string from the event's offset so it dies away over the release
+    // time, or with no release time stops it there once the block is rendered; the voice
+    // stays busy until the string is silent. Without tail-off (a steal, or all notes off)
+    // the voice is freed at once, so the string's part of the block up to the event is
+    // rendered now and the string stopped there - unless the synth is about to retrigger it.
+    void stopNote(float, bool allowTailOff) override {
+        if (retriggering)
+            return;
+        if (allowTailOff && bank.isActive(stringIndex)) {
+            auto releaseTime = shared.parameters.releaseTime;
+            if (releaseTime > 0.0f)
+                bank.releaseStringAt(stringIndex, shared.eventOffset, releaseGainFor(releaseTime));
+            else
+                bank.stopStringAt(stringIndex, shared.eventOffset);
+            return;
+        }
+        bank.renderStringUntil(stringIndex, shared.eventOffset);
+        stringDecayed();
+    }
+
+    // The mod wheel, pitch wheel and pressure are tracked by the synth per channel, and
+    // picked up by updateTuning()
+    virtual void controllerMoved(int,int) override {}
+    virtual void pitchWheelMoved(int) override {}
+
+private:
+    // Adds a new excitation to the loop as it plays, so the string keeps its state and the
+    // old note carries on under the new one. Only the new excitation is written.
+    void retrigger(int midiNoteNumber, float velocity) {
+        retriggering = false;
+        auto pickPosition = shared.parameters.mpe && isMemberChannel() ? shared.channels[(size_t) channel - 1].timbre
+                                                                       : shared.parameters.pickPosition;
+        auto excitationStart = juce::Time::getHighResolutionTicks();
+        retriggerSamples.setDelay(previousSamples.getDelay());
+        retriggerSamples.restart();
+        exciter.impulsePicked(retriggerSamples, excitationNote(midiNoteNumber), pickPosition);
+        shared.excitationTicks += juce::Time::getHighResolutionTicks() - excitationStart;
+        bank.retriggerString(stringIndex, retriggerSamples, velocity * oversampledGain(), shared.eventOffset);
+    }
+
+    // Octaves the string is oversampled by: 0, 1 or 2
+    int oversamplingOctaves() const {
+        return oversampling / 2;
+    }
+
+    // Oversampled, a pitch has the loop of the pitch as many octaves down at the base rate,
+    // so the tuning tables and excitations are looked up there
+    float tablePitch(float pitch) const {
+        return pitch - 12.0f * (float) oversamplingOctaves();
+    }
+
+    int excitationNote(int midiNoteNumber) const {
+        return juce::jmax(0, midiNoteNumber - 12 * oversamplingOctaves());
+    }
+
+    // The excitation's noise is spread over that many times the bandwidth, and decimation
+    // keeps only the bottom of it
+    float oversampledGain() const {
+        return std::sqrt((float) oversampling);
+    }
+
+    // Loop gain scale that takes the current pitch down 60 dB in releaseTime seconds
+    float releaseGainFor(float releaseTime) const {
+        auto frequency = MidiMessage::getMidiNoteInHertz(0) * std::exp2((currentPitch + bend) / 12.0f);
+        return (float) std::pow(10.0, -3.0 / (releaseTime * frequency));
+    }
+
+    juce::int64 noteSeed(int midiNoteNumber) const {
+        using Hash = FastRandom<1>;
+        auto hash = Hash::seedFor((juce::uint32) shared.seed ^ (juce::uint32) (shared.seed >> 32));
+        hash = Hash::seedFor(hash + (juce::uint32) midiNoteNumber);
+        hash = Hash::seedFor(hash + (juce::uint32) stringIndex);
+        return Hash::seedFor(hash + shared.noteOnCount);
+    }
+
+    // Low notes to the left, high notes to the right, like sitting at a piano
+    float stereoPositionFor(int midiNoteNumber) const {
+        return shared.parameters.stereoSpread * juce::jlimit(-1.0f, 1.0f, (midiNoteNumber - 60) / 36.0f);
+    }
+
+    static constexpr int lowestNote = 0;
+    static constexpr float brightnessTolerance = 0.002f;
+
+    bool isMemberChannel() const {
+        return channel != KsVoiceShared::masterChannel;
+    }
+
+    // In semitones. In MPE mode a note's own bend adds to the master channel's.
+    float targetBend() const {
+        auto& parameters = shared.parameters;
+        auto& own = shared.channels[(size_t) channel - 1];
+        if (! parameters.mpe || ! isMemberChannel())
+            return own.bend * parameters.bendRange;
+        auto& master = shared.channels[(size_t) KsVoiceShared::masterChannel - 1];
+        return own.bend * parameters.mpeBendRange + master.bend * parameters.bendRange;
+    }
+
+    // Where in the block the latest event moving this note's expression fell
+    int expressionChangedAt() const {
+        auto offset = juce::jmax(shared.modWheelChangedAt, shared.channels[(size_t) channel - 1].changedAt);
+        if (! shared.parameters.mpe || ! isMemberChannel())
+            return offset;
+        return juce::jmax(offset, shared.channels[(size_t) KsVoiceShared::masterChannel - 1].changedAt);
+    }
+
+    float targetPressure() const {
+        auto own = shared.channels[(size_t) channel - 1].pressure;
+        if (! shared.parameters.mpe || ! isMemberChannel())
+            return own;
+        return juce::jmax(own, shared.channels[(size_t) KsVoiceShared::masterChannel - 1].pressure);
+    }
+
+    float brightnessFor(float notePressure) const {
+        return juce::jlimit(0.0f, 1.0f, noteBrightness + notePressure * shared.parameters.pressureDepth);
+    }
+
+    // Full brightness takes either damping filter most of the way to no damping at all
+    static float dampingCoefficientFor(bool onePole, float brightness) {
+        return onePole ? 0.6f - 0.55f * brightness : 0.5f - 0.4f * brightness;
+    }
+
+    // Moves a sounding string's damping filter to brightness, keeping filterDelay in step
+    void setDampingBrightness(float brightness, float period) {
+        auto onePole = bank.isOnePoleDamping(stringIndex);
+        auto coefficient = dampingCoefficientFor(onePole, brightness);
+        bank.rampDamping(stringIndex, coefficient);
+        auto omega = juce::MathConstants<float>::twoPi / period;
+        filterDelay = (onePole ? onePolePhaseDelay(coefficient, omega) : coefficient) + dispersionDelay;
+        dampingBrightness = brightness;
+    }
+
+    // Chooses the loop filters for a note from the parameters, and sets filterDelay to
+    // their combined delay at the fundamental so tuning can allow for it. Once per note,
+    // so the trig here is affordable.
+    StringBank::LoopFilters loopFiltersFor(float period, float velocity) {
+        auto& parameters = shared.parameters;
+        auto omega = juce::MathConstants<float>::twoPi / period;
+        noteBrightness = juce::jlimit(0.0f, 1.0f, parameters.brightness);
+        dampingBrightness = brightnessFor(pressure);
+        StringBank::LoopFilters filters;
+
+        filters.onePoleDamping = parameters.onePoleDamping;
+        if (filters.onePoleDamping) {
+            filters.damping = dampingCoefficientFor(true, dampingBrightness);
+            filterDelay = onePolePhaseDelay(filters.damping, omega);
+        } else {
+            filters.stretch = dampingCoefficientFor(false, dampingBrightness);
+            filterDelay = filters.stretch;
+        }
+        dispersionDelay = 0.0f;
+
+        // Keep the stiffness allpasses' delay within half the loop, so high notes still tune
+        if (parameters.stiffness > 0.0f) {
+            constexpr auto numStages = LoopStage::Dispersion<float>::numStages;
+            auto maxStageDelay = 0.5f * period / numStages;
+            if (maxStageDelay > 1.0f) {
+                auto limit = (1.0f - maxStageDelay) / (1.0f + maxStageDelay);
+                filters.dispersion = juce::jmax(limit, -maxDispersion * juce::jlimit(0.0f, 1.0f, parameters.stiffness));
+                dispersionDelay = numStages * allPassPhaseDelay(filters.dispersion, omega);
+                filterDelay += dispersionDelay;
+            }
+        }
+
+        // Outside the loop, so it doesn't affect tuning
+        if (parameters.dynamics > 0.0f) {
+            filters.dynamicLevel = 1.0f - juce::jlimit(0.0f, 1.0f, parameters.dynamics) * (1.0f - velocity);
+            auto cutoff = juce::jmin(dynamicCutoffHarmonic / period, 0.25f);
+            filters.dynamicCoefficient = std::exp(-juce::MathConstants<float>::twoPi * cutoff);
+        }
+        return filters;
+    }
+
+    static constexpr float maxDispersion = 0.7f;
+    static constexpr float dynamicCutoffHarmonic = 4.0f;
+
+};
+
+class KsSynthesiser: public juce::Synthesiser {
+public:
+    // Replaces the voices. Allocates, so never call this from the audio thread, and
+    // call prepare() before rendering again.
+    void setNumVoices(int numVoices) {
+        clearVoices();
+        bank.setNumStrings(numVoices);
+        sympathetic.setNumVoices(numVoices);
+        for (auto i = 0; i < numVoices; i++) {
+            addVoice(new KsVoice(shared, bank, sympathetic, excitations, i));
+        }
+        updateDegradation();
+    }
+
+    // Sets the sample rate and allocates everything rendering needs: one arena holding
+    // every voice's string and retrigger excitation, sized for the lowest note at this rate, the bank's scratch
+    // space and the excitation cache. Starts the render workers if parallel rendering is
+    // on, and stops them if it isn't. Call after setNumVoices()
+    // whenever the rate, block size or channel count changes. Nothing allocates on the
+    // audio thread afterwards.
+    void prepare(double sampleRate, int maxBlockSize, int numChannels) {
+        setCurrentPlaybackSampleRate(sampleRate);
+        auto capacity = StringBuffer::capacityFor(KsVoice::maxLoopLengthFor(sampleRate));
+        stringArena.allocate((size_t) (2 * capacity * getNumVoices()), true);
+        for (int i = 0; i < getNumVoices(); i++)
+            static_cast<KsVoice*>(getVoice(i))->setStringStorage(stringArena.get() + (size_t) (2 * i * capacity),
+                                                                stringArena.get() + (size_t) ((2 * i + 1) * capacity),
+                                                                capacity);
+
+        workers.setNumWorkers(juce::jlimit(0, maxRenderWorkers, juce::SystemStats::getNumCpus() - 1));
+        bank.prepare(maxBlockSize, numChannels, &workers);
+        excitations.prepare(sampleRate, KsVoice::maxLoopLengthFor(sampleRate));
+        shared.tuning.prepare(sampleRate);
+        sympathetic.prepare(sampleRate, maxBlockSize, numChannels, &workers, shared.tuning);
+        blend.reset(sampleRate, rampSeconds);
+        loopGain.reset(sampleRate, rampSeconds);
+        baseDelay.setMaximumDelayInSamples(StringBank::latency);
+        baseDelay.prepare({ sampleRate, (juce::uint32) juce::jmax(1, maxBlockSize), (juce::uint32) juce::jmax(1, numChannels) });
+        baseDelay.setDelay((float) StringBank::latency);
+        updateRenderWorkers();
+    }
+
+    // Everything comes out this many samples late, so that oversampled strings, which the
+    // decimators hold back, line up with the rest. It is the same whether or not any
+    // string is oversampled, so switching oversampling never moves the latency.
+    int getLatencySamples() const {
+        return StringBank::latency;
+    }
+
+    // Probability of the loop keeping its sign: 1 gives strings, lower values drums.
+    // Ramped, so moving it while notes ring doesn't click.
+    void setBlend(float probability) {
+        blend.setTargetValue(juce::jlimit(0.0f, 1.0f, probability));
+    }
+
+    // Gain per trip round the loop, so below 1 every string dies away faster. Ramped.
+    void setLoopGain(float gain) {
+        loopGain.setTargetValue(juce::jlimit(0.0f, 1.0f, gain));
+    }
+
+    // Takes effect from the next note-on. Call from the audio thread, before rendering.
+    void setNoteParameters(const KsNoteParameters& newParameters) {
+        shared.parameters = newParameters;
+        sympathetic.setAmount(newParameters.coupling);
+        sympathetic.setOpenTuning(newParameters.openStrings);
+        excitations.setPickPosition(newParameters.pickPosition);
+    }
+
+    // Seeds every note from here on by its note, voice and count of note-ons since this
+    // call, so the same MIDI renders the same audio from any starting state
+    void setRandomSeed(juce::int64 seed) {
+        shared.seeded = true;
+        shared.seed = seed;
+        shared.noteOnCount = 0;
+        bank.setRandomSeed((juce::uint32) seed);
+    }
+
+    // Audio thread. The render workers only start once updateRenderWorkers() sees this;
+    // until then the strings render serially.
+    void setParallelRendering(bool shouldRenderInParallel) {
+        parallelRendering.store(shouldRenderInParallel);
+        bank.setParallel(shouldRenderInParallel);
+    }
+
+    // Starts the render workers if parallel rendering is on, or stops them if it is off, so
+    // a synth that never renders in parallel never has the threads. Call from the message
+    // thread, regularly while playing; not real-time safe.
+    void updateRenderWorkers() {
+        if (parallelRendering.load())
+            workers.start();
+        else
+            workers.stop();
+    }
+
+    void releaseResources() {
+        workers.stop();
+        bank.prepare(0, 0, nullptr);
+        sympathetic.releaseResources();
+    }
+
+    void setSilenceThreshold(float decibels) {
+        silenceThreshold = decibels;
+        updateDegradation();
+    }
+
+    // How much to shed under CPU pressure, from 0 (full quality) to 1. Raises the silence
+    // threshold so tails end sooner and lowers the number of strings allowed to sound.
+    void setDegradation(float amount) {
+        degradation = juce::jlimit(0.0f, 1.0f, amount);
+        updateDegradation();
+    }
+
+    // Use instead of renderNextBlock(). Handles every event in midi at its own sample
+    // position, then renders the block in one pass, so however dense the MIDI the strings
+    // run over whole blocks. A stolen string sounds up to the event that stole it.
+    void renderBlock(juce::AudioBuffer<float>& outputAudio, const juce::MidiBuffer& midi, int startSample, int numSamples) {
+        const juce::ScopedLock sl(lock);
+        for (const auto metadata : midi) {
+            auto message = metadata.getMessage();
+            shared.eventOffset = juce::jlimit(0, juce::jmax(0, numSamples - 1), metadata.samplePosition - startSample);
+            shared.eventChannel = message.getChannel();
+            handleMidiEvent(message);
+        }
+        shared.eventOffset = 0;
+        if (numSamples > 0)
+            renderVoices(outputAudio, startSample, numSamples);
+    }
+
+    int getNumActiveStrings() const {
+        return bank.getNumActiveStrings();
+    }
+
+    // Reads up to maxStrings sounding strings, lowest voice first, into rows of
+    // pointsPerRow samples, and their notes into notes. Returns how many it read.
+    // Audio thread only, between blocks.
+    int readStringLoops(float* rows, int* notes, int maxStrings, int pointsPerRow) const {
+        int numRead = 0;
+        for (int i = 0; i < voices.size() && numRead < maxStrings; i++) {
+            if (! bank.isActive(i))
+                continue;
+            auto* voice = static_cast<KsVoice*>(voices.getUnchecked(i));
+            voice->readLoop(rows + numRead * pointsPerRow, pointsPerRow);
+            notes[numRead++] = voice->getCurrentlyPlayingNote();
+        }
+        return numRead;
+    }
+
+    // What happened during the last processBlock, for the performance monitor. The counts
+    // are cleared by resetBlockStatistics(), which the processor calls before rendering.
+    int getNoteOns() const { return shared.noteOns; }
+    int getSteals() const { return steals; }
+    double getExcitationSeconds() const {
+        return juce::Time::highResolutionTicksToSeconds(shared.excitationTicks);
+    }
+
+    void resetBlockStatistics() {
+        shared.noteOns = 0;
+        steals = 0;
+        shared.excitationTicks = 0;
+    }
+
+protected:
+    // Render every sounding string in one pass instead of voice by voice, then free the
+    // voices whose strings have died away
+    void renderVoices(juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override {
+        while (bank.getNumActiveStrings() > voiceLimit)
+            stopQuietestVoice();
+        shared.expressionSmoothing = 1.0f - std::exp(-numSamples / (expressionSeconds * (float) getSampleRate()));
+        for (int i = 0; i < voices.size(); i++)
+            if (bank.isActive(i))
+                static_cast<KsVoice*>(voices.getUnchecked(i))->updateTuning(numSamples);
+        for (auto& expression : shared.channels)
+            expression.changedAt = 0;
+        shared.modWheelChangedAt = 0;
+        bank.setBlend(blend.skip(numSamples));
+        bank.setLoopGain(loopGain.skip(numSamples));
+        bank.renderStrings(outputAudio, startSample, numSamples);
+        for (auto index : bank.getFinishedStrings())
+            static_cast<KsVoice*>(voices.getUnchecked(index))->stringDecayed();
+        bank.clearFinishedStrings();
+        sympathetic.render(outputAudio, startSample, numSamples);
+        // Hold the base rate strings back to meet the oversampled ones
+        auto block = juce::dsp::AudioBlock<float>(outputAudio).getSubBlock((size_t) startSample, (size_t) numSamples);
+        baseDelay.process(juce::dsp::ProcessContextReplacing<float>(block));
+        bank.addOversampled(outputAudio, startSample, numSamples);
+    }
+
+    // A note already sounding on the channel, held or released, is plucked again on its own
+    // string rather than cut off and started on another voice
+    void noteOn(int midiChannel, int midiNoteNumber, float velocity) override {
+        for (int i = 0; i < voices.size(); i++) {
+            auto* voice = static_cast<KsVoice*>(voices.getUnchecked(i));
+            if (voice->getCurrentlyPlayingNote() == midiNoteNumber && voice->isPlayingChannel(midiChannel)
+                && bank.isActive(i)) {
+                voice->prepareRetrigger();
+                startVoice(voice, voice->getCurrentlyPlayingSound().get(), midiChannel, midiNoteNumber, velocity);
+                return;
+            }
+        }
+        juce::Synthesiser::noteOn(midiChannel, midiNoteNumber, velocity);
+    }
+
+    void handleController(int midiChannel, int controllerNumber, int controllerValue) override {
+        if (controllerNumber == timbreController) {
+            expressionFor(midiChannel).timbre = controllerValue / 127.0f;
+            return;
+        }
+        if (controllerNumber == 1) {
+            shared.modWheel = controllerValue / 127.0f;
+            shared.modWheelChangedAt = shared.eventOffset;
+        }
+        juce::Synthesiser::handleController(midiChannel, controllerNumber, controllerValue);
+    }
+
+    // Stored rather than passed to each voice; voices read them once a block
+    void handlePitchWheel(int midiChannel, int wheelValue) override {
+        auto& expression = expressionFor(midiChannel);
+        expression.bend = juce::jlimit(-1.0f, 1.0f, (wheelValue - 8192) / 8191.0f);
+        expression.changedAt = shared.eventOffset;
+    }
+
+    void handleChannelPressure(int midiChannel, int channelPressureValue) override {
+        auto& expression = expressionFor(midiChannel);
+        expression.pressure = channelPressureValue / 127.0f;
+        expression.changedAt = shared.eventOffset;
+    }
+
+    // Steal the quietest string, going by the bank's level tracking. Strings whose key has
+    // been released count as quieter than held ones, and ties go to the oldest note.
+    // Whatever this returns gets cut off, so it's where steals are counted.
+    juce::SynthesiserVoice* findVoiceToSteal(juce::SynthesiserSound*, int, int) const override {
+        juce::SynthesiserVoice* quietest = nullptr;
+        float quietestLevel = 0.0f;
+        for (int i = 0; i < voices.size(); i++) {
+            if (! bank.isActive(i))
+                continue;
+            auto* voice = voices.getUnchecked(i);
+            auto level = bank.getPeakLevel(i) * (voice->isKeyDown() ? heldNoteWeighting : 1.0f);
+            if (quietest == nullptr || level < quietestLevel
+                || (level == quietestLevel && voice->wasStartedBefore(*quietest))) {
+                quietest = voice;
+                quietestLevel = level;
+            }
+        }
+        if (quietest != nullptr)
+            steals++;
+        return quietest;
+    }
+
+private:
+    KsChannelExpression& expressionFor(int midiChannel) {
+        return shared.channels[(size_t) juce::jlimit(1, 16, midiChannel) - 1];
+    }
+
+    void stopQuietestVoice() {
+        if (auto* voice = findVoiceToSteal(nullptr, 0, 0))
+            static_cast<KsVoice*>(voice)->stringDecayed();
+    }
+
+    void updateDegradation() {
+        bank.setSilenceThreshold(juce::Decibels::decibelsToGain(silenceThreshold + degradation * maxThresholdRaise));
+        auto numVoices = getNumVoices();
+        auto fewestVoices = juce::jmin(numVoices, minVoicesUnderLoad);
+        voiceLimit = numVoices - juce::roundToInt(degradation * (numVoices - fewestVoices));
+    }
+
+    static constexpr float heldNoteWeighting = 4.0f;
+    static constexpr float maxThresholdRaise = 40.0f;
+    static constexpr int minVoicesUnderLoad = 8;
+    static constexpr int maxRenderWorkers = 7;
+    static constexpr double rampSeconds = 0.05;
+    static constexpr float expressionSeconds = 0.01f;
+    static constexpr int timbreController = 74;
+
+    RenderWorkers workers;
+    std::atomic<bool> parallelRendering { false };
+    StringBank bank;
+    SympatheticStrings sympathetic { bank };
+    juce::HeapBlock<float> stringArena;
+    ExcitationCache excitations;
+    float silenceThreshold = -90.0f;
+    float degradation = 0.0f;
+    int voiceLimit = 0;
+    mutable int steals = 0;
+    juce::SmoothedValue<float> blend { 1.0f };
+    juce::SmoothedValue<float> loopGain { 1.0f };
+    juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> baseDelay;
+    KsVoiceShared shared;
+};
+
+#endif /* KsSynthesiser_h */
@@ -0,0 +1,81 @@
+//
+//  Oversampling.h
+//  KarplusStrong
+//
+//  Brings strings rendered at 2x or 4x the sample rate back down to it. Only strings are
+//  ever oversampled, and they are generated at the high rate, so there is no upsampling:
+//  each factor's strings are summed into one bus and decimated together.
+//
+//  Each halving is a linear phase half-band FIR. Every other tap of a half-band filter is
+//  zero apart from the centre one, and only every other output is kept, so each output
+//  costs one multiply per nonzero tap pair.
+//
+
+#ifndef Oversampling_h
+#define Oversampling_h
+
+#include <JuceHeader.h>
+#include <array>
+#include <vector>
+
+class HalfBandDecimator {
+public:
+    static constexpr int numTaps = 47;
+    static constexpr int latency = (numTaps - 1) / 2;   // in input samples
+    static constexpr int delay = latency - 1;            // of output n behind input 2n
+
+    // Allocates for up to maxInputSamples per call; not real-time safe
+    void prepare(int maxInputSamples) {
+        work.assign((size_t) (maxInputSamples + historySize), 0.0f);
+    }
+
+    void reset() {
+        std::fill(work.begin(), work.end(), 0.0f);
+    }
+
+    // Halves numInput (even) samples of input into output, which may be the same buffer
+    void process(const float* input, float* output, int numInput) {
+        jassert(numInput % 2 == 0 && numInput + historySize <= (int) work.size());
+        auto* x = work.data();
+        std::copy(input, input + numInput, x + historySize);
+        auto& h = taps();
+        for (int n = 0; n < numInput / 2; n++) {
+            auto* centre = x + 2 * n + 1 + latency;
+            auto sum = 0.5f * centre[0];
+            for (int j = 0; j < numPairs; j++)
+                sum += h[(size_t) j] * (centre[-(2 * j + 1)] + centre[2 * j + 1]);
+            output[n] = sum;
+        }
+        std::copy(x + numInput, x + numInput + historySize, x);
+    }
+
+private:
+    static constexpr int historySize = numTaps - 1;
+    static constexpr int numPairs = (latency + 1) / 2;
+
+    // The odd taps either side of the centre, nearest first: a Blackman windowed sinc
+    // scaled for unity gain at DC
+    static const std::array<float, numPairs>& taps() {
+        static const std::array<float, numPairs> h = [] {
+            std::array<double, numPairs> odd {};
+            auto sum = 0.5;   // the centre tap
+            for (int j = 0; j < numPairs; j++) {
+                auto k = 2 * j + 1;
+                auto phase = juce::MathConstants<double>::pi * (latency + k) / (numTaps - 1);
+                auto window = 0.42 - 0.5 * std::cos(2.0 * phase) + 0.08 * std::cos(4.0 * phase);
+                odd[(size_t) j] = std::sin(juce::MathConstants<double>::halfPi * k)
+                                / (juce::MathConstants<double>::pi * k) * window;
+                sum += 2.0 * odd[(size_t) j];
+            }
+            std::array<float, numPairs> scaled {};
+            for (int j = 0; j < numPairs; j++)
+                scaled[(size_t) j] = (float) (odd[(size_t) j] * 0.5 / (sum - 0.5));
+            return scaled;
+        }();
+        return h;
+    }
+
+    std::vector<float> work;   // historySize samples of the last input, then the new input
+};
+
+#endif /* Oversampling_h */
@@ -0,0 +1,145 @@
+//
+//  PerfMonitor.h
+//  KarplusStrong
+//
+//  Per-block performance records from the audio thread, passed to whoever is watching
+//  through a wait-free single producer, single consumer FIFO. Nothing is recorded unless
+//  a reader has enabled the monitor, so with the editor closed each block costs one
+//  relaxed atomic load.
+//
+//  The reader drains records into PerfStats, which keeps a window of recent blocks for
+//  min/mean/p99 figures and a histogram of CPU load.
+//
+
+#ifndef PerfMonitor_h
+#define PerfMonitor_h
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <array>
+#include <vector>
+
+struct PerfRecord {
+    int numSamples;
+    float blockSeconds;        // time spent in processBlock
+    float load;                // blockSeconds as a fraction of the block's duration
+    int activeVoices;
+    int noteOns;
+    float excitationSeconds;   // time spent starting notes, within blockSeconds
+    int steals;                // sounding strings cut short for a new note or under load
+    bool overBudget;
+};
+
+class PerfMonitor {
+public:
+    static constexpr int capacity = 1024;
+
+    // Reader side
+    void setEnabled(bool shouldRecord) {
+        enabled.store(shouldRecord, std::memory_order_relaxed);
+    }
+
+    // Audio thread: whether it's worth gathering a record at all
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // Audio thread. Never blocks; a record that doesn't fit is counted and dropped.
+    void push(const PerfRecord& record) {
+        if (! isEnabled())
+            return;
+        const auto scope = fifo.write(1);
+        if (scope.blockSize1 > 0)
+            records[(size_t) scope.startIndex1] = record;
+        else
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Reader side. Calls callback for each waiting record, oldest first.
+    template <typename Callback>
+    void drain(Callback&& callback) {
+        const auto scope = fifo.read(fifo.getNumReady());
+        for (int i = 0; i < scope.blockSize1; i++)
+            callback(records[(size_t) (scope.startIndex1 + i)]);
+        for (int i = 0; i < scope.blockSize2; i++)
+            callback(records[(size_t) (scope.startIndex2 + i)]);
+    }
+
+    // Records lost because the reader fell behind
+    int getNumDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    juce::AbstractFifo fifo { capacity };
+    std::array<PerfRecord, capacity> records {};
+    std::atomic<bool> enabled { false };
+    std::atomic<int> dropped { 0 };
+};
+
+// Summary of the most recent blocks, for display. Message thread only.
+class PerfStats {
+public:
+    static constexpr int windowSize = 2048;
+    static constexpr int numHistogramBins = 20;   // 5% of the block's duration each; the last also holds overloads
+
+    void add(const PerfRecord& record) {
+        loads[(size_t) next] = record.load;
+        next = (next + 1) % windowSize;
+        count = juce::jmin(count + 1, windowSize);
+        latest = record;
+        totalNoteOns += record.noteOns;
+        totalSteals += record.steals;
+        totalOverBudget += record.overBudget ? 1 : 0;
+        if (record.noteOns > 0)
+            maxExcitationSecondsPerNote = juce::jmax(maxExcitationSecondsPerNote, record.excitationSeconds / record.noteOns);
+    }
+
+    struct Summary {
+        float minLoad = 0.0f;
+        float meanLoad = 0.0f;
+        float p99Load = 0.0f;
+        float maxLoad = 0.0f;
+        std::array<int, numHistogramBins> histogram {};
+    };
+
+    // Sorts a copy of the window, so call it at display rate rather than per record
+    Summary summarise() {
+        Summary summary;
+        if (count == 0)
+            return summary;
+        sorted.assign(loads.begin(), loads.begin() + count);
+        std::sort(sorted.begin(), sorted.end());
+        summary.minLoad = sorted.front();
+        summary.maxLoad = sorted.back();
+        summary.p99Load = sorted[(size_t) juce::jmin(count - 1, (int) std::ceil(0.99 * count) - 1)];
+        double total = 0.0;
+        for (auto load : sorted) {
+            total += load;
+            auto bin = juce::jlimit(0, numHistogramBins - 1, (int) (load * numHistogramBins));
+            summary.histogram[(size_t) bin]++;
+        }
+        summary.meanLoad = (float) (total / count);
+        return summary;
+    }
+
+    const PerfRecord& getLatest() const { return latest; }
+    int getNumBlocks() const { return count; }
+    juce::int64 getTotalNoteOns() const { return totalNoteOns; }
+    juce::int64 getTotalSteals() const { return totalSteals; }
+    juce::int64 getTotalOverBudget() const { return totalOverBudget; }
+    float getMaxExcitationSecondsPerNote() const { return maxExcitationSecondsPerNote; }
+
+private:
+    std::array<float, windowSize> loads {};
+    std::vector<float> sorted = std::vector<float>(windowSize);
+    int next = 0;
+    int count = 0;
+    PerfRecord latest {};
+    juce::int64 totalNoteOns = 0;
+    juce::int64 totalSteals = 0;
+    juce::int64 totalOverBudget = 0;
+    float maxExcitationSecondsPerNote = 0.0f;
+};
+
+#endif /* PerfMonitor_h */
@@ -15,20 +15,117 @@ KarplusStrongAudioProcessorEditor::KarplusStrongAudioProcessorEditor (KarplusStr
 {
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
-    pickPosition.setRange(0.0, 1.0);
-    addAndMakeVisible(&pickPosition);
-    pickPosition.addListener(this);
-    pickPosition.setSliderStyle (juce::Slider::LinearBarVertical);
-    pickPosition.setRange (0.0, 1.0, 0.05);
-    pickPosition.setTextBoxStyle (juce::Slider::NoTextBox, false, 90, 0);
-    pickPosition.setPopupDisplayEnabled (true, false, this);
-    pickPosition.setTextValueSuffix (" Posn");
-    pickPosition.setValue(0.5);
+    setSize (560, 480);
+    addSlider (pickPosition, pickPositionAttachment, "pickPosition", " Posn");
+    addSlider (brightness, brightnessAttachment, "brightness", " Bright");
+    addSlider (decay, decayAttachment, "decay", " Decay");
+    addSlider (blend, blendAttachment, "blend", " Blend");
+    addSlider (stereoSpread, stereoSpreadAttachment, "stereoSpread", " Spread");
+    addSlider (level, levelAttachment, "level", " dB");
+    audioProcessor.perfMonitor.setEnabled (true);
+    audioProcessor.stringScope.setEnabled (true);
+    startTimerHz (scopeRefreshHz);
+}
+
+// The attachment takes the slider's range from the parameter and keeps the two in sync,
+// with the host seeing the edits as automation gestures
+void KarplusStrongAudioProcessorEditor::addSlider (juce::Slider& slider, std::unique_ptr<SliderAttachment>& attachment,
+                                                   const juce::String& parameterID, const juce::String& suffix)
+{
+    addAndMakeVisible (&slider);
+    slider.setSliderStyle (juce::Slider::LinearBarVertical);
+    slider.setTextBoxStyle (juce::Slider::NoTextBox, false, 90, 0);
+    slider.setPopupDisplayEnabled (true, false, this);
+    slider.setTextValueSuffix (suffix);
+    attachment = std::make_unique<SliderAttachment> (audioProcessor.parameters, parameterID, slider);
 }
 
 KarplusStrongAudioProcessorEditor::~KarplusStrongAudioProcessorEditor()
 {
+    stopTimer();
+    audioProcessor.perfMonitor.setEnabled (false);
+    audioProcessor.stringScope.setEnabled (false);
+}
+
+void KarplusStrongAudioProcessorEditor::timerCallback()
+{
+    if (auto* frame = audioProcessor.stringScope.readLatest())
+    {
+        drawScope (*frame);
+        repaint (scopeArea);
+    }
+
+    if (++timerTicks % (scopeRefreshHz / perfRefreshHz) == 0)
+    {
+        audioProcessor.perfMonitor.drain ([this] (const PerfRecord& record) { perfStats.add (record); });
+        perfSummary = perfStats.summarise();
+        repaint (perfArea);
+    }
+}
+
+void KarplusStrongAudioProcessorEditor::drawScope (const ScopeFrame& frame)
+{
+    if (! scopeImage.isValid())
+        return;
+    juce::Graphics g (scopeImage);
+    g.fillAll (juce::Colours::black);
+    auto area = scopeImage.getBounds().toFloat();
+    drawStrings (g, frame, area.removeFromLeft (area.getWidth() / 2).reduced (4.0f));
+    drawSpectrum (g, frame, area.reduced (4.0f));
+}
+
+// One lane per sounding string, coloured by note, showing the whole loop left to right
+void KarplusStrongAudioProcessorEditor::drawStrings (juce::Graphics& g, const ScopeFrame& frame, juce::Rectangle<float> area)
+{
+    if (frame.numStrings == 0)
+        return;
+    auto laneHeight = area.getHeight() / frame.numStrings;
+    auto step = area.getWidth() / (ScopeFrame::pointsPerString - 1);
+    for (int string = 0; string < frame.numStrings; string++)
+    {
+        auto lane = area.removeFromTop (laneHeight);
+        auto& points = frame.strings[(size_t) string];
+        scopePath.clear();
+        for (int i = 0; i < ScopeFrame::pointsPerString; i++)
+        {
+            auto y = lane.getCentreY() - 0.5f * lane.getHeight() * juce::jlimit (-1.0f, 1.0f, points[(size_t) i]);
+            if (i == 0)
+                scopePath.startNewSubPath (lane.getX(), y);
+            else
+                scopePath.lineTo (lane.getX() + i * step, y);
+        }
+        g.setColour (juce::Colour::fromHSV ((float) frame.notes[(size_t) string] / 128.0f, 0.7f, 1.0f, 1.0f));
+        g.strokePath (scopePath, juce::PathStrokeType (1.0f));
+    }
+}
+
+// Magnitude of the output on log frequency (20 Hz to Nyquist) and dB (-100 to 0) axes
+void KarplusStrongAudioProcessorEditor::drawSpectrum (juce::Graphics& g, const ScopeFrame& frame, juce::Rectangle<float> area)
+{
+    std::copy (frame.output.begin(), frame.output.end(), fftData.begin());
+    std::fill (fftData.begin() + ScopeFrame::outputSize, fftData.end(), 0.0f);
+    window.multiplyWithWindowingTable (fftData.data(), (size_t) ScopeFrame::outputSize);
+    fft.performFrequencyOnlyForwardTransform (fftData.data());
+
+    auto nyquist = frame.sampleRate / 2.0;
+    auto logRange = std::log (nyquist / lowestDisplayedHz);
+    auto scale = 4.0f / ScopeFrame::outputSize;   // a full scale sine at 0 dB, allowing for the window
+    scopePath.clear();
+    for (int bin = 1; bin < ScopeFrame::outputSize / 2; bin++)
+    {
+        auto frequency = bin * frame.sampleRate / ScopeFrame::outputSize;
+        if (frequency < lowestDisplayedHz)
+            continue;
+        auto x = area.getX() + area.getWidth() * (float) (std::log (frequency / lowestDisplayedHz) / logRange);
+        auto decibels = juce::Decibels::gainToDecibels (fftData[(size_t) bin] * scale, -100.0f);
+        auto y = juce::jmap (decibels, -100.0f, 0.0f, area.getBottom(), area.getY());
+        if (scopePath.isEmpty())
+            scopePath.startNewSubPath (x, y);
+        else
+            scopePath.lineTo (x, y);
+    }
+    g.setColour (juce::Colours::lightblue);
+    g.strokePath (scopePath, juce::PathStrokeType (1.0f));
 }
 
 //==============================================================================
@@ -37,19 +134,61 @@ void KarplusStrongAudioProcessorEditor::paint (juce::Graphics& g)
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
 
+    paintPerformance (g, perfArea);
+    g.drawImageAt (scopeImage, scopeArea.getX(), scopeArea.getY());
+}
+
+// Load figures are fractions of the block's duration, shown as percentages
+void KarplusStrongAudioProcessorEditor::paintPerformance (juce::Graphics& g, juce::Rectangle<int> area)
+{
+    auto percent = [] (float load) { return juce::String (load * 100.0f, 1) + "%"; };
+    const auto& latest = perfStats.getLatest();
+    juce::StringArray lines {
+        "Load  min " + percent (perfSummary.minLoad) + "  avg " + percent (perfSummary.meanLoad),
+        "      p99 " + percent (perfSummary.p99Load) + "  max " + percent (perfSummary.maxLoad),
+        "Block " + juce::String (latest.blockSeconds * 1.0e6f, 0) + " us, " + juce::String (latest.numSamples) + " samples",
+        "Voices " + juce::String (latest.activeVoices),
+        "Note-ons " + juce::String (perfStats.getTotalNoteOns())
+            + ", worst " + juce::String (perfStats.getMaxExcitationSecondsPerNote() * 1.0e6f, 1) + " us",
+        "Steals " + juce::String (perfStats.getTotalSteals()),
+        "Over budget " + juce::String (perfStats.getTotalOverBudget()),
+        "Dropped " + juce::String (audioProcessor.perfMonitor.getNumDropped())
+    };
+
     g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
+    g.setFont (juce::Font (juce::Font::getDefaultMonospacedFontName(), 12.0f, juce::Font::plain));
+    auto text = area.removeFromTop (lines.size() * 15);
+    for (auto& line : lines)
+        g.drawText (line, text.removeFromTop (15), juce::Justification::centredLeft, false);
+
+    // Histogram of load over the recent window, 0 to 100% left to right
+    area.removeFromTop (10);
+    auto total = juce::jmax (1, perfStats.getNumBlocks());
+    auto barWidth = (float) area.getWidth() / PerfStats::numHistogramBins;
+    g.setColour (juce::Colours::orange);
+    for (int bin = 0; bin < PerfStats::numHistogramBins; bin++)
+    {
+        auto height = area.getHeight() * (float) perfSummary.histogram[(size_t) bin] / total;
+        g.fillRect (area.getX() + bin * barWidth, area.getBottom() - height, barWidth - 1.0f, height);
+    }
+    g.setColour (juce::Colours::grey);
+    g.drawRect (area);
 }
 
 void KarplusStrongAudioProcessorEditor::resized()
 {
     // This is generally where you'll want to lay out the positions of any
     // subcomponents in your editor..
-    pickPosition.setBounds (40, 30, 20, getHeight() - 60);
-}
+    auto bounds = getLocalBounds();
+    scopeArea = bounds.removeFromBottom (180).reduced (10);
+    scopeImage = juce::Image (juce::Image::ARGB, juce::jmax (1, scopeArea.getWidth()), juce::jmax (1, scopeArea.getHeight()), true);
 
-void KarplusStrongAudioProcessorEditor::sliderValueChanged (juce::Slider* slider)
-{
-    *audioProcessor.pickPosition = static_cast<float>(pickPosition.getValue()); 
+    juce::Slider* sliders[] = { &pickPosition, &brightness, &decay, &blend, &stereoSpread, &level };
+    auto x = 40;
+    for (auto* slider : sliders)
+    {
+        slider->setBounds (x, 30, 20, bounds.getHeight() - 60);
+        x += 40;
+    }
+    perfArea = bounds.withTrimmedLeft (x).reduced (10, 30);
 }
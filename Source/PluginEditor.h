@@ -15,7 +15,7 @@
 /**
 */
 class KarplusStrongAudioProcessorEditor  : public juce::AudioProcessorEditor,
-private juce::Slider::Listener
+                                           private juce::Timer
 {
 public:
     KarplusStrongAudioProcessorEditor (KarplusStrongAudioProcessor&);
@@ -26,11 +26,36 @@ public:
     void resized() override;
 
 private:
-    void sliderValueChanged (juce::Slider* slider) override;
+    void timerCallback() override;
+    void paintPerformance (juce::Graphics& g, juce::Rectangle<int> area);
+    void drawScope (const ScopeFrame& frame);
+    void drawStrings (juce::Graphics& g, const ScopeFrame& frame, juce::Rectangle<float> area);
+    void drawSpectrum (juce::Graphics& g, const ScopeFrame& frame, juce::Rectangle<float> area);
+    using SliderAttachment = juce::AudioProcessorValueTreeState::SliderAttachment;
+    void addSlider (juce::Slider& slider, std::unique_ptr<SliderAttachment>& attachment,
+                    const juce::String& parameterID, const juce::String& suffix);
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     KarplusStrongAudioProcessor& audioProcessor;
-    juce::Slider pickPosition;
+    juce::Slider pickPosition, brightness, decay, blend, stereoSpread, level;
+    std::unique_ptr<SliderAttachment> pickPositionAttachment, brightnessAttachment, decayAttachment,
+                                      blendAttachment, stereoSpreadAttachment, levelAttachment;
+    PerfStats perfStats;
+    PerfStats::Summary perfSummary;
+    juce::Rectangle<int> perfArea;
+    static constexpr int perfRefreshHz = 10;
+
+    // Drawn into scopeImage when a new frame arrives, so repaints just blit it
+    juce::Rectangle<int> scopeArea;
+    juce::Image scopeImage;
+    juce::Path scopePath;
+    juce::dsp::FFT fft { ScopeFrame::outputOrder };
+    juce::dsp::WindowingFunction<float> window { (size_t) ScopeFrame::outputSize,
+                                                 juce::dsp::WindowingFunction<float>::hann };
+    std::array<float, 2 * ScopeFrame::outputSize> fftData {};
+    int timerTicks = 0;
+    static constexpr int scopeRefreshHz = 30;
+    static constexpr double lowestDisplayedHz = 20.0;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (KarplusStrongAudioProcessorEditor)
 };
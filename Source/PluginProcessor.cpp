@@ -8,111 +8,89 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
-#include "Filters.h"
-#include "Utils.h"
-#include "Exciter.h"
-#include <vector>
-
-using juce::dsp::DelayLine;
-using juce::MidiMessage;
-
-
-struct KsSound: public juce::SynthesiserSound {
-    KsSound() {}
-    bool appliesToNote(int) override {return true;}
-    bool appliesToChannel(int) override {return true;}
-};
-
-class KsVoice: public juce::SynthesiserVoice {
-    // Parameters that should be user adjustable
-public:
-    float pickPosition = 0.5;
-    
-    // Not parameters
-private:
-    DelayLine<float> previousSamples;
-    Exciter exciter;
-    LowPass lp;
-    AllPass ap;
-    bool isPlaying = false;
-    float level = 0.0;
-    
-public:
-    KsVoice(){
-        // Set up the delay line
-        juce::dsp::ProcessSpec spec { getSampleRate(), 1024, 1 };
-        previousSamples.prepare(spec);
-        int maxLoopLen = getSampleRate() / MidiMessage::getMidiNoteInHertz(0);
-        previousSamples.setMaximumDelayInSamples(maxLoopLen);
-        exciter.prepare(maxLoopLen, spec);
-    }
-
-    bool canPlaySound (juce::SynthesiserSound* sound) override {
-        return true;
-    }
-    
-    void startNote(int midiNoteNumber, float velocity, juce::SynthesiserSound*, int) override {
-        float fundamentalFreq = juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber);
-        auto [requiredPreviousSamples, requiredPhaseDelay] = calculateRequiredDelays(fundamentalFreq);
-        ap.updateCoefficient(requiredPhaseDelay, fundamentalFreq, getSampleRate());
-        previousSamples.setDelay(requiredPreviousSamples);
-//        exciter.populateImpulse(previousSamples);
-        exciter.impulsePicked(previousSamples, pickPosition);
-        level = velocity;
-        isPlaying = true;
-    }
-    
-    void renderNextBlock(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override {
-        if (isPlaying) {
-            for (int channel = 0; channel < outputBuffer.getNumChannels(); channel++) {
-                for(int i = 0; i < numSamples; i++) {
-                    // Get previous sample
-                    float inputSample = previousSamples.popSample(0);
-                    // Lowpass it
-                    float intermediateSample = lp.getNextSample(inputSample);
-                    // Allpass it
-                    float outputSample = ap.getNextOutput(intermediateSample);
-                    // Push it to delay line
-                    previousSamples.pushSample(0, outputSample);
-                    outputBuffer.addSample(channel, startSample + i, outputSample * level);
-                }
-            }
-        }
-    }
-    
-    void stopNote(float, bool) override {
-        clearCurrentNote();
-        isPlaying = false;
-        lp.clearState();
-        ap.clearState();
-        previousSamples.reset();
-    }
-    
-    virtual void controllerMoved(int,int) override {}
-    virtual void pitchWheelMoved(int) override {}
-    
-private:
-    std::tuple<float, float> calculateRequiredDelays(float fundamentalFreq) {
-        float requiredLoopDelay = getSampleRate() / fundamentalFreq;
-        float requiredPreviousSamples = floor(requiredLoopDelay - 0.5);
-        auto requiredPhaseDelay = requiredLoopDelay - 0.5 - requiredPreviousSamples;
-        return {requiredPreviousSamples, requiredPhaseDelay};
-    }
-};
-
+#include "KsSynthesiser.h"
 
 
 //==============================================================================
 KarplusStrongAudioProcessor::KarplusStrongAudioProcessor()
      : AudioProcessor (BusesProperties()
-                       .withOutput ("Output", juce::AudioChannelSet::mono(), true)
-                       ){
-    for (auto i = 0; i < 6; i++) {
-        synth.addVoice(new KsVoice());
-    };
+                       .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
+                       ),
+       parameters (*this, nullptr, "Parameters", createParameterLayout())
+{
     synth.addSound(new KsSound());
-         addParameter(pickPosition = new juce::AudioParameterFloat(juce::ParameterID { "pickPosition",  1 }, "Pick Position", 0.0f, 1.0f, 0.5f));
+    setNumVoices(maxVoices->get());
+    presets.build(*this);
+}
 
+// Creates every parameter, keeping a typed pointer to each so the audio thread can read
+// them without looking them up
+juce::AudioProcessorValueTreeState::ParameterLayout KarplusStrongAudioProcessor::createParameterLayout()
+{
+    juce::AudioProcessorValueTreeState::ParameterLayout layout;
+    auto add = [&layout] (auto*& pointer, auto parameter) {
+        pointer = parameter.get();
+        layout.add(std::move(parameter));
+    };
+    // The pick position slider steps by 0.05, which is also what the excitation cache covers
+    add(pickPosition, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "pickPosition",  1 }, "Pick Position", juce::NormalisableRange<float>(0.0f, 1.0f, 0.05f), 0.5f));
+    add(stereoSpread, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "stereoSpread",  1 }, "Stereo Spread", 0.0f, 1.0f, 0.5f));
+    add(silenceThreshold, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "silenceThreshold",  1 }, "Silence Threshold", -120.0f, -60.0f, -90.0f));
+    // Only read when the processor is prepared, since changing it reallocates the voices, so
+    // a change applies once the host re-prepares the plugin and it isn't automatable
+    add(maxVoices, std::make_unique<juce::AudioParameterInt>(juce::ParameterID { "maxVoices",  1 }, "Max Voices", 1, 256, 64,
+                                                             juce::AudioParameterIntAttributes().withAutomatable(false)));
+    // Fraction of each block's duration the synth may spend rendering before it starts
+    // shedding voices and tails. 0 disables the budget.
+    add(cpuBudget, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "cpuBudget",  1 }, "CPU Budget", 0.0f, 1.0f, 0.0f));
+    // Spread voices over worker threads; only kicks in with enough voices sounding
+    add(parallelRender, std::make_unique<juce::AudioParameterBool>(juce::ParameterID { "parallelRender",  1 }, "Parallel Render", false));
+    // Probability each loop sample keeps its sign. 1 is a plucked string, 0.5 a drum.
+    add(blend, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "blend",  1 }, "Blend", 0.0f, 1.0f, 1.0f));
+    // Less damping in the loop filter, for a brighter string that rings longer
+    add(brightness, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "brightness",  1 }, "Brightness", 0.0f, 1.0f, 0.0f));
+    // Gain on each trip round the loop; below 1 shortens every note
+    add(decay, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "decay",  1 }, "Decay", 0.95f, 1.0f, 1.0f));
+    add(level, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "level",  1 }, "Level", -48.0f, 6.0f, 0.0f));
+    // Semitones either way at full pitch wheel
+    add(bendRange, std::make_unique<juce::AudioParameterInt>(juce::ParameterID { "bendRange",  1 }, "Bend Range", 0, 24, 2));
+    // Seconds for a new note to slide from the previous one's pitch; 0 turns glide off
+    add(glideTime, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "glideTime",  1 }, "Glide Time", 0.0f, 2.0f, 0.0f));
+    add(vibratoRate, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "vibratoRate",  1 }, "Vibrato Rate", 0.1f, 12.0f, 5.0f));
+    // Semitones of vibrato at full mod wheel
+    add(vibratoDepth, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "vibratoDepth",  1 }, "Vibrato Depth", 0.0f, 2.0f, 0.5f));
+    // Loop filter used by new notes: the classic two-tap average, or a one pole lowpass
+    add(damping, std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { "damping",  1 }, "Damping", juce::StringArray { "Average", "One-pole" }, 0));
+    // Stretches the partials sharp, like a stiff piano string
+    add(stiffness, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "stiffness",  1 }, "Stiffness", 0.0f, 1.0f, 0.0f));
+    // How much duller softly played notes are
+    add(dynamics, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "dynamics",  1 }, "Dynamics", 0.0f, 1.0f, 0.0f));
+    // Brightness added by full channel pressure, on top of the brightness the note started with
+    add(pressureDepth, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "pressureDepth",  1 }, "Pressure Depth", 0.0f, 1.0f, 0.5f));
+    // Per-note pitch bend, pressure and timbre on channels 2-16, with channel 1 as the master
+    add(mpe, std::make_unique<juce::AudioParameterBool>(juce::ParameterID { "mpe",  1 }, "MPE", false));
+    // Semitones either way at full per-note bend
+    add(mpeBendRange, std::make_unique<juce::AudioParameterInt>(juce::ParameterID { "mpeBendRange",  1 }, "MPE Bend Range", 1, 96, 48));
+    // How strongly strings in tune with each other ring in sympathy
+    add(coupling, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "coupling",  1 }, "Coupling", 0.0f, 1.0f, 0.0f));
+    // Unplayed strings, tuned like an instrument's, that only sound by sympathy. Need some coupling.
+    add(openStrings, std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { "openStrings",  1 }, "Open Strings", SympatheticStrings::openTuningNames(), 0));
+    // Resonance of an instrument body or cabinet, applied to the mix of all the strings
+    add(body, std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { "body",  1 }, "Body", BodyResonance::bodyNames(), 0));
+    add(bodyMix, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "bodyMix",  1 }, "Body Mix", 0.0f, 1.0f, 0.7f));
+    // Zero latency, or less CPU for a fixed latency. Only read when the processor is prepared,
+    // which is also the only time the latency is reported, so a change needs the plugin
+    // restarting (or the host re-preparing it) and the parameter isn't automatable.
+    add(bodyPartitioning, std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { "bodyPartitioning",  1 }, "Body Partitioning", juce::StringArray { "Zero Latency", "Low CPU" }, 0,
+                                                                       juce::AudioParameterChoiceAttributes().withAutomatable(false)));
+    // Seconds for a released note to die away by 60 dB; 0 stops it dead at the note-off
+    add(release, std::make_unique<juce::AudioParameterFloat>(juce::ParameterID { "release",  1 }, "Release", juce::NormalisableRange<float>(0.0f, 4.0f, 0.0f, 0.4f), 0.15f));
+    // High notes run their strings at 2x or 4x the sample rate, which keeps them in tune and
+    // stops them sounding dull, for a little more CPU per note
+    add(oversampling, std::make_unique<juce::AudioParameterChoice>(juce::ParameterID { "oversampling",  1 }, "Oversampling", juce::StringArray { "Off", "Up to 2x", "Up to 4x" }, 2));
+    // Lowest note oversampled 2x; notes an octave above it and higher get 4x if allowed
+    add(oversamplingNote, std::make_unique<juce::AudioParameterInt>(juce::ParameterID { "oversamplingNote",  1 }, "Oversampling Note", 48, 127, 84));
+    return layout;
 }
 
 KarplusStrongAudioProcessor::~KarplusStrongAudioProcessor()
@@ -125,11 +103,53 @@ void KarplusStrongAudioProcessor::prepareToPlay (double sampleRate, int samplesP
 {
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
-    synth.setCurrentPlaybackSampleRate(sampleRate);
+    if (synth.getNumVoices() != maxVoices->get())
+        setNumVoices(maxVoices->get());
+    synth.setParallelRendering(parallelRender->get());
+    synth.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
+    startTimer(renderWorkerPollMilliseconds);
+    outputLevel.reset(sampleRate, 0.02);
+    outputLevel.setCurrentAndTargetValue(juce::Decibels::decibelsToGain(level->get()));
+    stringScope.prepare(sampleRate);
+    bodyResonance.setBody(body->getIndex(), bodyMix->get(), false);
+    bodyResonance.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels(),
+                          static_cast<BodyResonance::Partitioning>(bodyPartitioning->getIndex()));
+    setLatencySamples(synth.getLatencySamples() + bodyResonance.getLatency());
+    degradation = 0.0f;
+    synth.setDegradation(degradation);
+}
+
+void KarplusStrongAudioProcessor::captureScope (const juce::AudioBuffer<float>& buffer)
+{
+    stringScope.pushOutput(buffer, buffer.getNumSamples());
+    if (auto* frame = stringScope.startFrame(buffer.getNumSamples())) {
+        frame->numStrings = synth.readStringLoops(frame->strings[0].data(), frame->notes.data(),
+                                                  ScopeFrame::maxStrings, ScopeFrame::pointsPerString);
+        stringScope.publishFrame();
+    }
+}
+
+// Only gathers anything while someone is watching
+void KarplusStrongAudioProcessor::recordPerformance (double elapsedSeconds, int numSamples)
+{
+    if (! perfMonitor.isEnabled() || numSamples == 0)
+        return;
+    PerfRecord record;
+    record.numSamples = numSamples;
+    record.blockSeconds = (float) elapsedSeconds;
+    record.load = (float) (elapsedSeconds * getSampleRate() / numSamples);
+    record.activeVoices = synth.getNumActiveStrings();
+    record.noteOns = synth.getNoteOns();
+    record.excitationSeconds = (float) synth.getExcitationSeconds();
+    record.steals = synth.getSteals();
+    auto budget = cpuBudget->get();
+    record.overBudget = record.load > (budget > 0.0f ? budget : 1.0f);
+    perfMonitor.push(record);
 }
 
 void KarplusStrongAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    auto blockStartTicks = juce::Time::getHighResolutionTicks();
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
@@ -138,11 +158,73 @@ void KarplusStrongAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer
     // channels that didn't contain input data in case they contain nonzero data
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
-    for (int i = 0; i < synth.getNumVoices(); i++) {
-        auto voice = dynamic_cast<KsVoice*>(synth.getVoice(i));
-        voice->pickPosition = pickPosition->get();
+
+    // A preset or state being loaded is read as a whole, rather than parameter by parameter
+    auto* loading = snapshotLoader.acquire();
+    auto value = [loading] (const auto* parameter) { return ParameterSnapshot::valueOf(parameter, loading); };
+    KsNoteParameters noteParameters;
+    noteParameters.pickPosition = value(pickPosition);
+    noteParameters.stereoSpread = value(stereoSpread);
+    noteParameters.brightness = value(brightness);
+    noteParameters.onePoleDamping = value(damping) == 1;
+    noteParameters.stiffness = value(stiffness);
+    noteParameters.dynamics = value(dynamics);
+    noteParameters.bendRange = (float) value(bendRange);
+    noteParameters.glideTime = value(glideTime);
+    noteParameters.releaseTime = value(release);
+    noteParameters.vibratoRate = value(vibratoRate);
+    noteParameters.vibratoDepth = value(vibratoDepth);
+    noteParameters.pressureDepth = value(pressureDepth);
+    noteParameters.mpe = value(mpe);
+    noteParameters.mpeBendRange = (float) value(mpeBendRange);
+    noteParameters.coupling = value(coupling);
+    noteParameters.openStrings = value(openStrings);
+    noteParameters.maxOversampling = 1 << value(oversampling);
+    noteParameters.oversamplingNote = value(oversamplingNote);
+    synth.setNoteParameters(noteParameters);
+    synth.setSilenceThreshold(value(silenceThreshold));
+    synth.setParallelRendering(value(parallelRender));
+    synth.setBlend(value(blend));
+    synth.setLoopGain(value(decay));
+    outputLevel.setTargetValue(juce::Decibels::decibelsToGain(value(level)));
+    bodyResonance.setBody(value(body), value(bodyMix), isNonRealtime());
+    snapshotLoader.release();
+
+    synth.resetBlockStatistics();
+    synth.renderBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+    bodyResonance.process(buffer, buffer.getNumSamples());
+    outputLevel.applyGain(buffer, buffer.getNumSamples());
+    if (stringScope.isEnabled())
+        captureScope(buffer);
+    auto elapsed = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - blockStartTicks);
+    updateCpuLoad(elapsed, buffer.getNumSamples());
+    recordPerformance(elapsed, buffer.getNumSamples());
+}
+
+// Back off quickly when a block runs over budget and recover slowly once there is headroom
+void KarplusStrongAudioProcessor::updateCpuLoad (double elapsedSeconds, int numSamples)
+{
+    auto budget = cpuBudget->get();
+    if (budget <= 0.0f || isNonRealtime() || numSamples == 0) {
+        degradation = 0.0f;
+    } else {
+        auto load = elapsedSeconds * getSampleRate() / numSamples;
+        if (load > budget)
+            degradation = juce::jmin(1.0f, degradation + 0.1f);
+        else if (load < 0.8 * budget)
+            degradation = juce::jmax(0.0f, degradation - 0.01f);
     }
-    synth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+    synth.setDegradation(degradation);
+}
+
+void KarplusStrongAudioProcessor::setRandomSeed (juce::int64 seed)
+{
+    synth.setRandomSeed(seed);
+}
+
+void KarplusStrongAudioProcessor::setNumVoices (int numVoices)
+{
+    synth.setNumVoices(numVoices);
 }
 
 //==============================================================================
@@ -183,33 +265,54 @@ bool KarplusStrongAudioProcessor::isMidiEffect() const
 
 double KarplusStrongAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    // How long a middle C takes to ring down to the silence threshold. Low strings ring
+    // far longer than any host will wait, so cap it.
+    auto sampleRate = getSampleRate() > 0 ? getSampleRate() : 44100.0;
+    auto tail = StringBank::decayTimeSeconds(juce::MidiMessage::getMidiNoteInHertz(60), sampleRate,
+                                             -silenceThreshold->get());
+    return juce::jmin(tail, maxTailSeconds);
 }
 
 int KarplusStrongAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return presets.size();
 }
 
 int KarplusStrongAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return currentProgram.load();
 }
 
 void KarplusStrongAudioProcessor::setCurrentProgram (int index)
 {
+    if (! juce::isPositiveAndBelow(index, presets.size()))
+        return;
+    currentProgram.store(index);
+    applySnapshot(presets.getSnapshot(index));
 }
 
 const juce::String KarplusStrongAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return presets.getName(index);
 }
 
+// The factory presets can't be renamed
 void KarplusStrongAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
 }
 
+// The audio thread uses the whole snapshot from its next block, while the parameters are
+// brought into line for the host and editor. Voices carry on.
+void KarplusStrongAudioProcessor::applySnapshot (const ParameterSnapshot& snapshot)
+{
+    snapshotLoader.begin(snapshot);
+    auto& all = getParameters();
+    for (int index = 0; index < all.size(); index++)
+        if (snapshot.contains(index))
+            all[index]->setValueNotifyingHost(snapshot.values[(size_t) index]);
+    snapshotLoader.end();
+}
+
 //==============================================================================
 
 
@@ -217,6 +320,14 @@ void KarplusStrongAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    stopTimer();
+    synth.releaseResources();
+}
+
+// Starts or stops the render workers when parallel rendering is switched, off the audio thread
+void KarplusStrongAudioProcessor::timerCallback()
+{
+    synth.updateRenderWorkers();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -257,17 +368,63 @@ juce::AudioProcessorEditor* KarplusStrongAudioProcessor::createEditor()
 }
 
 //==============================================================================
+// State is a magic number and version, the current program, then each parameter's ID and
+// normalised value. Reading the values straight from the parameters takes no locks, so
+// hosts can ask as often as they like while rendering.
 void KarplusStrongAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    juce::MemoryOutputStream stream(destData, false);
+    stream.writeInt(stateMagic);
+    stream.writeCompressedInt(stateVersion);
+    stream.writeCompressedInt(currentProgram.load());
+    auto& all = getParameters();
+    stream.writeCompressedInt(all.size());
+    for (auto* parameter : all) {
+        auto* ranged = static_cast<juce::RangedAudioParameter*>(parameter);
+        stream.writeString(ranged->getParameterID());
+        stream.writeFloat(ranged->getValue());
+    }
 }
 
+// Restores every parameter: the state's value where it has one, and the parameter's
+// default where it doesn't (as for one added since the state was saved), rather than
+// whatever the last session left it at. Values for parameters this version doesn't know
+// are skipped. State saved as XML by earlier versions is read the same way.
 void KarplusStrongAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+    auto& all = getParameters();
+    restoredState.reset(all.size());
+    for (int index = 0; index < all.size(); index++)
+        restoredState.set(index, all[index]->getDefaultValue());
+
+    juce::MemoryInputStream stream(data, (size_t) juce::jmax(0, sizeInBytes), false);
+    if (sizeInBytes < 4 || stream.readInt() != stateMagic) {
+        // Sessions saved as XML by earlier versions: one PARAM element per parameter
+        if (auto xml = getXmlFromBinary(data, sizeInBytes)) {
+            if (xml->hasTagName(parameters.state.getType())) {
+                for (auto* element : xml->getChildWithTagNameIterator("PARAM"))
+                    if (auto* parameter = parameters.getParameter(element->getStringAttribute("id")))
+                        restoredState.set(parameter->getParameterIndex(),
+                                          parameter->convertTo0to1((float) element->getDoubleAttribute("value")));
+                applySnapshot(restoredState);
+            }
+        }
+        return;
+    }
+    if (stream.readCompressedInt() > stateVersion)
+        return;
+
+    auto program = stream.readCompressedInt();
+    auto numParameters = stream.readCompressedInt();
+    for (int i = 0; i < numParameters && ! stream.isExhausted(); i++) {
+        auto id = stream.readString();
+        auto normalisedValue = stream.readFloat();
+        if (auto* parameter = parameters.getParameter(id))
+            restoredState.set(parameter->getParameterIndex(), normalisedValue);
+    }
+    if (juce::isPositiveAndBelow(program, presets.size()))
+        currentProgram.store(program);
+    applySnapshot(restoredState);
 }
 
 //==============================================================================
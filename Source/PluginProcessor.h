@@ -9,17 +9,56 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "KsSynthesiser.h"
+#include "PerfMonitor.h"
+#include "StringScope.h"
+#include "Presets.h"
+#include "BodyResonance.h"
 
 //==============================================================================
 /**
 */
-class KarplusStrongAudioProcessor  : public juce::AudioProcessor
+class KarplusStrongAudioProcessor  : public juce::AudioProcessor,
+                                     private juce::Timer
                             #if JucePlugin_Enable_ARA
                              , public juce::AudioProcessorARAExtension
                             #endif
 {
 public:
     juce::AudioParameterFloat* pickPosition;
+    juce::AudioParameterFloat* stereoSpread;
+    juce::AudioParameterFloat* silenceThreshold;
+    juce::AudioParameterInt* maxVoices;
+    juce::AudioParameterFloat* cpuBudget;
+    juce::AudioParameterBool* parallelRender;
+    juce::AudioParameterFloat* blend;
+    juce::AudioParameterFloat* brightness;
+    juce::AudioParameterFloat* decay;
+    juce::AudioParameterFloat* level;
+    juce::AudioParameterInt* bendRange;
+    juce::AudioParameterFloat* glideTime;
+    juce::AudioParameterFloat* vibratoRate;
+    juce::AudioParameterFloat* vibratoDepth;
+    juce::AudioParameterChoice* damping;
+    juce::AudioParameterFloat* stiffness;
+    juce::AudioParameterFloat* dynamics;
+    juce::AudioParameterFloat* pressureDepth;
+    juce::AudioParameterBool* mpe;
+    juce::AudioParameterInt* mpeBendRange;
+    juce::AudioParameterFloat* coupling;
+    juce::AudioParameterChoice* openStrings;
+    juce::AudioParameterChoice* body;
+    juce::AudioParameterFloat* bodyMix;
+    juce::AudioParameterChoice* bodyPartitioning;
+    juce::AudioParameterFloat* release;
+    juce::AudioParameterChoice* oversampling;
+    juce::AudioParameterInt* oversamplingNote;
+    // Owns the parameters above; the editor attaches its controls here
+    juce::AudioProcessorValueTreeState parameters;
+    // Block timings and counts, for the editor or an offline tool to read while enabled
+    PerfMonitor perfMonitor;
+    // Snapshots of the strings and output for the editor, captured only while enabled
+    StringScope stringScope;
     //==============================================================================
     KarplusStrongAudioProcessor();
     ~KarplusStrongAudioProcessor() override;
@@ -57,10 +96,33 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
+    // For offline rendering: seeds the noise of every note from here on, so the same MIDI
+    // renders the same audio. Render non-realtime too, or the CPU budget can shed voices.
+    void setRandomSeed (juce::int64 seed);
+
 private:
     //==============================================================================
-    void updateAngleDelta();
-    juce::Synthesiser synth;
+    juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
+    // Replaces the synth's voices. Allocates, so never call this from the audio thread.
+    void setNumVoices (int numVoices);
+    void updateCpuLoad (double elapsedSeconds, int numSamples);
+    void timerCallback() override;
+    void recordPerformance (double elapsedSeconds, int numSamples);
+    void captureScope (const juce::AudioBuffer<float>& buffer);
+    // Loads snapshot into the parameters without the audio thread seeing it half done
+    void applySnapshot (const ParameterSnapshot& snapshot);
+    static constexpr int stateMagic = 0x4b537374;   // "KSst"
+    static constexpr int stateVersion = 1;
+    static constexpr double maxTailSeconds = 60.0;
+    static constexpr int renderWorkerPollMilliseconds = 100;
+    float degradation = 0.0f;
+    juce::SmoothedValue<float> outputLevel { 1.0f };
+    KsSynthesiser synth;
+    PresetBank presets;
+    std::atomic<int> currentProgram { 0 };
+    ParameterSnapshot restoredState;
+    ParameterSnapshotLoader snapshotLoader;
+    BodyResonance bodyResonance;
     
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (KarplusStrongAudioProcessor)
@@ -0,0 +1,183 @@
+//
+//  Presets.h
+//  KarplusStrong
+//
+//  Factory presets, and the handoff that makes loading one - or restoring a session -
+//  look instantaneous to the audio thread.
+//
+//  Setting parameters one by one from the message thread would let the audio thread
+//  render a block with half the old preset and half the new one. Instead each preset is
+//  built up front into an immutable ParameterSnapshot of normalised values. Loading one
+//  hands the audio thread a pointer to the snapshot, which it reads in preference to the
+//  parameters, then sets the parameters (so the host and editor follow) and takes the
+//  pointer back. The audio thread never waits, allocates or resets a voice.
+//
+
+#ifndef Presets_h
+#define Presets_h
+
+#include <JuceHeader.h>
+#include "BodyResonance.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Normalised values for some of a processor's parameters, by parameter index
+struct ParameterSnapshot {
+    std::vector<float> values;
+    std::vector<bool> included;
+
+    // Sizes the snapshot for numParameters with none included. Allocates only if the size changes.
+    void reset(int numParameters) {
+        values.resize((size_t) numParameters);
+        included.resize((size_t) numParameters);
+        std::fill(included.begin(), included.end(), false);
+    }
+
+    void set(int index, float normalisedValue) {
+        values[(size_t) index] = juce::jlimit(0.0f, 1.0f, normalisedValue);
+        included[(size_t) index] = true;
+    }
+
+    bool contains(int index) const {
+        return juce::isPositiveAndBelow(index, (int) included.size()) && included[(size_t) index];
+    }
+
+    // The value the audio thread should use for parameter: the snapshot's, if there is one
+    // being loaded that includes it, and the parameter's own otherwise
+    static float valueOf(const juce::AudioParameterFloat* parameter, const ParameterSnapshot* snapshot) {
+        auto index = parameter->getParameterIndex();
+        return snapshot != nullptr && snapshot->contains(index)
+                 ? parameter->convertFrom0to1(snapshot->values[(size_t) index]) : parameter->get();
+    }
+
+    static int valueOf(const juce::AudioParameterInt* parameter, const ParameterSnapshot* snapshot) {
+        auto index = parameter->getParameterIndex();
+        return snapshot != nullptr && snapshot->contains(index)
+                 ? juce::roundToInt(parameter->convertFrom0to1(snapshot->values[(size_t) index])) : parameter->get();
+    }
+
+    static bool valueOf(const juce::AudioParameterBool* parameter, const ParameterSnapshot* snapshot) {
+        auto index = parameter->getParameterIndex();
+        return snapshot != nullptr && snapshot->contains(index) ? snapshot->values[(size_t) index] >= 0.5f
+                                                                : parameter->get();
+    }
+
+    // For a choice, the index of the chosen item
+    static int valueOf(const juce::AudioParameterChoice* parameter, const ParameterSnapshot* snapshot) {
+        auto index = parameter->getParameterIndex();
+        return snapshot != nullptr && snapshot->contains(index)
+                 ? juce::roundToInt(parameter->convertFrom0to1(snapshot->values[(size_t) index])) : parameter->getIndex();
+    }
+};
+
+// Passes the snapshot being loaded to the audio thread. The audio thread brackets its
+// parameter reads with acquire() and release(); a hazard pointer tells the loader when it
+// has finished with a snapshot, so the loader can reuse it for the next state restore.
+class ParameterSnapshotLoader {
+public:
+    // Loader side. Apply the snapshot to the parameters between these two.
+    void begin(const ParameterSnapshot& snapshot) {
+        loading.store(&snapshot);
+    }
+
+    // Returns once the audio thread is no longer reading the snapshot
+    void end() {
+        auto* finished = loading.exchange(nullptr);
+        while (finished != nullptr && inUse.load() == finished)
+            std::this_thread::yield();
+    }
+
+    // Audio thread: the snapshot being loaded, or nullptr. Valid until release().
+    const ParameterSnapshot* acquire() {
+        auto* snapshot = loading.load();
+        inUse.store(snapshot);
+        if (snapshot != loading.load()) {
+            inUse.store(nullptr);
+            return nullptr;
+        }
+        return snapshot;
+    }
+
+    void release() {
+        inUse.store(nullptr);
+    }
+
+private:
+    std::atomic<const ParameterSnapshot*> loading { nullptr };
+    std::atomic<const ParameterSnapshot*> inUse { nullptr };
+};
+
+// The factory presets. Each sets every sound parameter - those in soundParameterIDs - to
+// its listed plain value or its default, and leaves the rest (voice count, CPU budget,
+// controller setup) alone.
+class PresetBank {
+public:
+    struct Preset {
+        const char* name;
+        std::vector<std::pair<const char*, float>> values;
+    };
+
+    // Not real-time safe. Call once the processor's parameters exist.
+    void build(const juce::AudioProcessor& processor) {
+        snapshots.clear();
+        for (auto& preset : factoryPresets()) {
+            ParameterSnapshot snapshot;
+            snapshot.reset(processor.getParameters().size());
+            for (auto* parameter : processor.getParameters()) {
+                auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter);
+                if (ranged == nullptr || ! soundParameterIDs().contains(ranged->getParameterID()))
+                    continue;
+                auto value = ranged->getDefaultValue();
+                for (auto& [id, plainValue] : preset.values)
+                    if (ranged->getParameterID() == id)
+                        value = ranged->convertTo0to1(plainValue);
+                snapshot.set(parameter->getParameterIndex(), value);
+            }
+            snapshots.push_back(std::move(snapshot));
+        }
+    }
+
+    int size() const {
+        return (int) snapshots.size();
+    }
+
+    juce::String getName(int index) const {
+        return juce::isPositiveAndBelow(index, size()) ? factoryPresets()[(size_t) index].name : "";
+    }
+
+    const ParameterSnapshot& getSnapshot(int index) const {
+        return snapshots[(size_t) index];
+    }
+
+    static const juce::StringArray& soundParameterIDs() {
+        static const juce::StringArray ids { "pickPosition", "stereoSpread", "blend", "brightness", "decay", "level",
+                                             "glideTime", "vibratoRate", "vibratoDepth", "damping", "stiffness",
+                                             "dynamics", "pressureDepth", "body", "bodyMix",
+                                             "coupling", "openStrings", "release" };
+        return ids;
+    }
+
+private:
+    static const std::vector<Preset>& factoryPresets() {
+        static const std::vector<Preset> presets {
+            { "Plucked String", {} },
+            { "Bright Steel", { { "brightness", 0.7f }, { "damping", 1.0f }, { "pickPosition", 0.2f },
+                                { "stiffness", 0.15f }, { "dynamics", 0.3f } } },
+            { "Soft Harp", { { "brightness", 0.3f }, { "dynamics", 0.6f }, { "stereoSpread", 0.8f },
+                             { "body", (float) BodyResonance::parlour }, { "bodyMix", 0.5f }, { "release", 2.0f } } },
+            { "Piano Wire", { { "brightness", 0.5f }, { "damping", 1.0f }, { "stiffness", 0.6f },
+                              { "dynamics", 0.5f }, { "pickPosition", 0.15f } } },
+            { "Palm Muted", { { "decay", 0.97f }, { "pickPosition", 0.15f }, { "release", 0.05f } } },
+            { "Slide", { { "brightness", 0.5f }, { "glideTime", 0.15f }, { "vibratoDepth", 0.3f } } },
+            { "Snare", { { "blend", 0.5f }, { "brightness", 0.8f }, { "decay", 0.985f } } },
+            { "Tom", { { "blend", 0.75f }, { "brightness", 0.3f }, { "decay", 0.99f } } },
+            { "Acoustic", { { "body", (float) BodyResonance::acoustic } } },
+        };
+        return presets;
+    }
+
+    std::vector<ParameterSnapshot> snapshots;
+};
+
+#endif /* Presets_h */
@@ -0,0 +1,169 @@
+//
+//  RenderWorkers.h
+//  KarplusStrong
+//
+//  A persistent pool of worker threads the audio thread can hand a batch of independent
+//  tasks to. Tasks are claimed from a shared atomic counter, so a worker that finishes
+//  early takes over work the others haven't reached, and the calling thread takes part
+//  too. Handing over work and waiting for it takes no locks and allocates nothing.
+//
+//  Workers spin while there is regular work, and only go to sleep on an event after a
+//  period of inactivity, so waking them only costs a signal after the synth has been idle.
+//
+//  The threads only exist between start() and stop(), which the synth calls from the
+//  message thread as parallel rendering is turned on and off. While they are stopped,
+//  run() does every task on the calling thread.
+//
+
+#ifndef RenderWorkers_h
+#define RenderWorkers_h
+
+#include <JuceHeader.h>
+#include <atomic>
+
+class RenderWorkers {
+public:
+    // Called as task(context, taskIndex, workerIndex). workerIndex is 0 for the calling
+    // thread and 1..getNumWorkers() for the pool, for picking per-thread scratch space.
+    using Task = void (*)(void* context, int taskIndex, int workerIndex);
+
+    ~RenderWorkers() {
+        stop();
+    }
+
+    // How many threads start() runs, for sizing per-worker scratch space. Stops any running.
+    void setNumWorkers(int newNumWorkers) {
+        stop();
+        numWorkers = newNumWorkers;
+    }
+
+    int getNumWorkers() const {
+        return numWorkers;
+    }
+
+    // Not real-time safe, but may be called while another thread is in run()
+    void start() {
+        if (isRunning())
+            return;
+        for (int i = 0; i < numWorkers; i++)
+            workers.add(new Worker(*this, i + 1))->startThread(juce::Thread::Priority::highest);
+        running.store(numWorkers > 0);
+    }
+
+    // Waits for a run() in progress to finish with the threads, then ends them
+    void stop() {
+        running.store(false);
+        while (inUse.load())
+            pause();
+        for (auto* worker : workers)
+            worker->signalThreadShouldExit();
+        for (auto* worker : workers)
+            worker->wake.signal();
+        workers.clear();
+    }
+
+    bool isRunning() const {
+        return running.load();
+    }
+
+    // Runs task for every index in [0, numTasks) and returns once they have all finished.
+    // Only one thread may call this at a time.
+    void run(int numTasks, Task task, void* context) {
+        // Sequentially consistent, pairing with stop(): either this sees the pool stopping
+        // or stop() sees it in use and waits
+        inUse.store(true);
+        if (! running.load()) {
+            inUse.store(false);
+            for (int i = 0; i < numTasks; i++)
+                task(context, i, 0);
+            return;
+        }
+        currentTask = task;
+        currentContext = context;
+        totalTasks.store(numTasks, std::memory_order_relaxed);
+        finishedTasks.store(0, std::memory_order_relaxed);
+        auto generation = ++lastGeneration;
+        // Sequentially consistent so a worker about to sleep either sees the new work or
+        // is seen as sleeping
+        taskCounter.store((juce::uint64) generation << 32);
+        for (auto* worker : workers)
+            if (worker->sleeping.load())
+                worker->wake.signal();
+
+        claimTasks(generation, 0);
+        while (finishedTasks.load(std::memory_order_acquire) < numTasks)
+            pause();
+        inUse.store(false);
+    }
+
+private:
+    struct Worker: public juce::Thread {
+        Worker(RenderWorkers& ownerToUse, int index)
+            : juce::Thread("KarplusStrong render " + juce::String(index)), owner(ownerToUse), workerIndex(index) {}
+
+        ~Worker() override {
+            stopThread(1000);
+        }
+
+        void run() override {
+            auto seenGeneration = owner.currentGeneration();
+            while (! threadShouldExit()) {
+                auto idleSince = juce::Time::getMillisecondCounter();
+                while (owner.currentGeneration() == seenGeneration && ! threadShouldExit()) {
+                    if (juce::Time::getMillisecondCounter() - idleSince < spinMilliseconds) {
+                        pause();
+                    } else {
+                        sleeping.store(true);
+                        if ((juce::uint32) (owner.taskCounter.load() >> 32) == seenGeneration)
+                            wake.wait(sleepMilliseconds);
+                        sleeping.store(false, std::memory_order_release);
+                    }
+                }
+                seenGeneration = owner.currentGeneration();
+                owner.claimTasks(seenGeneration, workerIndex);
+            }
+        }
+
+        RenderWorkers& owner;
+        int workerIndex;
+        std::atomic<bool> sleeping { false };
+        juce::WaitableEvent wake;
+    };
+
+    juce::uint32 currentGeneration() const {
+        return (juce::uint32) (taskCounter.load(std::memory_order_acquire) >> 32);
+    }
+
+    // The generation and the next task index share one atomic, so a worker still looking
+    // for work from an earlier batch can never claim a task from a newer one
+    void claimTasks(juce::uint32 generation, int workerIndex) {
+        auto value = taskCounter.load(std::memory_order_acquire);
+        while ((juce::uint32) (value >> 32) == generation
+               && (int) (value & 0xffffffff) < totalTasks.load(std::memory_order_relaxed)) {
+            if (taskCounter.compare_exchange_weak(value, value + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                currentTask(currentContext, (int) (value & 0xffffffff), workerIndex);
+                finishedTasks.fetch_add(1, std::memory_order_release);
+            }
+        }
+    }
+
+    static void pause() {
+        std::this_thread::yield();
+    }
+
+    static constexpr juce::uint32 spinMilliseconds = 250;
+    static constexpr int sleepMilliseconds = 20;
+
+    juce::OwnedArray<Worker> workers;
+    int numWorkers = 0;
+    std::atomic<bool> running { false };
+    std::atomic<bool> inUse { false };   // the calling thread is in run() with the pool
+    Task currentTask = nullptr;
+    void* currentContext = nullptr;
+    juce::uint32 lastGeneration = 0;
+    std::atomic<int> totalTasks { 0 };
+    std::atomic<int> finishedTasks { 0 };
+    std::atomic<juce::uint64> taskCounter { 0 };
+};
+
+#endif /* RenderWorkers_h */
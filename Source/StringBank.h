@@ -0,0 +1,989 @@
+//
+//  StringBank.h
+//  KarplusStrong
+//
+//  Runs the string loops of every sounding voice in lockstep. Filter state is kept in
+//  structure-of-arrays form, one entry per string, and the lowpass + allpass recurrence
+//  is evaluated for a group of strings at once in a SIMD register.
+//
+//  A string's output only comes back round after getDelay() samples, so each group is
+//  processed in chunks no longer than its shortest loop: the chunk's input is read out
+//  of every loop up front, filtered, and written back in one go.
+//
+//  The peak output of each string is tracked per chunk. Once a string has stayed below
+//  the silence threshold for a whole loop period it can never get louder again, so it is
+//  stopped and reported through getFinishedStrings().
+//
+//  With a blend below 1 each loop output's sign is flipped at random, turning the strings
+//  into drums. Every string has its own generator state, so the noise doesn't depend on
+//  which group or thread renders it, and nothing random is drawn while blend is 1.
+//
+//  Each string's loop filters are a LoopChain (see Filters.h) picked when it starts.
+//  Strings are grouped by chain as well as length, and each chain has its own
+//  instantiation of the render loop, so no per-sample work is spent on filters a string
+//  doesn't use.
+//
+//  A whole block is rendered in one pass however many MIDI events fall inside it. A string
+//  can start or stop part way through: before its start offset it reads silence and leaves
+//  its loop alone, which keeps its freshly cleared filters at zero, and from its stop offset
+//  its output gain is zero. Retuning ramps the allpass coefficient, and a change of
+//  brightness the damping coefficient, across the block from a given offset.
+//
+//  A string's loop gain can be scaled down on its own, and a resident string is never
+//  stopped for being silent; SympatheticStrings uses both for strings that are fed by others.
+//
+//  Groups are independent, so with enough of them they can be farmed out to a
+//  RenderWorkers pool. Each group then renders into its own scratch buffer, and those are
+//  summed in group order, so the result is identical to rendering them one after another.
+//
+//  A short loop, as a high note has at the base rate, leaves the fractional delay allpass
+//  and the damping lowpass working near Nyquist, which detunes and overdamps it. Such
+//  strings can be started oversampled, 2x or 4x: their loops are that many times longer,
+//  they are grouped apart and rendered at the higher rate into a bus per factor, and
+//  each bus is brought back down by HalfBandDecimator stages. The decimators put 4x
+//  strings 16.5 samples behind and 2x ones 11; each bus is delayed at its own rate to
+//  come out exactly latency samples behind. render() adds them like that, while a caller
+//  that holds its base rate output back by latency (as KsSynthesiser does) renders with
+//  renderStrings() and adds the buses with addOversampled() afterwards. Oversampled
+//  groups render on the calling thread.
+//
+
+#ifndef StringBank_h
+#define StringBank_h
+
+#include <JuceHeader.h>
+#include <limits>
+#include <vector>
+#include "Utils.h"
+#include "Filters.h"
+#include "RenderWorkers.h"
+#include "Oversampling.h"
+
+class StringBank {
+public:
+    using Vec = juce::dsp::SIMDRegister<float>;
+    static constexpr int lanes = (int) Vec::SIMDNumElements;
+    static constexpr int maxChunkSize = 256;
+    static constexpr int minParallelGroups = 4;
+    static constexpr int minParallelSamples = 32;
+    // Base rate samples the oversampled strings come out behind the others: the 4x
+    // decimators' delay rounded up, so every factor is padded to the same whole number
+    static constexpr int latency = (HalfBandDecimator::delay * 3 + 3) / 4;
+
+    // How a string's loop filters its signal, fixed for the length of a note
+    struct LoopFilters {
+        float stretch = 0.5f;             // weight of the older tap of the averaging lowpass
+        bool onePoleDamping = false;      // damp with a one pole lowpass instead of the average
+        float damping = 0.5f;             // that lowpass's coefficient
+        float dispersion = 0.0f;          // coefficient of the stiffness allpasses; 0 leaves them out
+        float dynamicLevel = 1.0f;        // below 1 the output is dulled, as for softer playing
+        float dynamicCoefficient = 0.0f;  // coefficient of the dynamic level lowpass
+    };
+
+    // Not real-time safe - call when the voices are (re)created
+    void setNumStrings(int numStrings) {
+        loops.assign(numStrings, nullptr);
+        allPassCoefficient.assign(numStrings, 0.0f);
+        allPassTarget.assign(numStrings, 0.0f);
+        dampingTarget.assign(numStrings, 0.5f);
+        rampOffset.assign(numStrings, 0);
+        loopGainScale.assign(numStrings, 1.0f);
+        resident.assign(numStrings, false);
+        filters.assign(numStrings, {});
+        chain.assign(numStrings, 0);
+        lowPassState.assign(numStrings, 0.0f);
+        dispersionState.assign((size_t) (numStrings * dispersionStateSize), 0.0f);
+        levelState.assign(numStrings, 0.0f);
+        allPassInput.assign(numStrings, 0.0f);
+        allPassOutput.assign(numStrings, 0.0f);
+        level.assign(numStrings, 0.0f);
+        pan.assign(numStrings, 0.0f);
+        peakLevel.assign(numStrings, 0.0f);
+        silentSamples.assign(numStrings, 0);
+        randomState.assign(numStrings, 1u);
+        startOffset.assign(numStrings, 0);
+        stopOffset.assign(numStrings, notStopping);
+        releaseGain.assign(numStrings, 1.0f);
+        nextReleaseGain.assign(numStrings, 1.0f);
+        releaseOffset.assign(numStrings, notStopping);
+        injection.assign(numStrings, nullptr);
+        injectionStart.assign(numStrings, 0);
+        injected.assign(numStrings, 0);
+        injectionGain.assign(numStrings, 0.0f);
+        fedSamples.assign(numStrings, 0);
+        feedInput.assign(numStrings, 0.0f);
+        feedOutput.assign(numStrings, 0.0f);
+        lastStartOffset.assign(numStrings, 0);
+        active.assign(numStrings, false);
+        activeStrings.clear();
+        activeStrings.reserve(numStrings);
+        finishedStrings.clear();
+        finishedStrings.reserve(numStrings);
+        groups.clear();
+        groups.reserve((size_t) (maxGroupsFor(numStrings)));
+    }
+
+    // Allocates scratch space for blocks of up to maxBlockSize samples, with one chunk
+    // buffer per worker. Call after setNumStrings(); not real-time safe.
+    void prepare(int maxBlockSize, int maxChannels, RenderWorkers* workersToUse) {
+        workers = workersToUse;
+        blockCapacity = maxBlockSize;
+        channelCapacity = juce::jmin(maxChannels, maxGroupChannels);
+        auto numWorkers = workers != nullptr ? workers->getNumWorkers() : 0;
+        workerChunks.allocate((size_t) (numWorkers * scratchCapacity + lanes), true);
+        groupOutput.allocate((size_t) (maxGroupsFor(getNumStrings()) * channelCapacity * maxBlockSize), true);
+        feed.allocate((size_t) (getNumStrings() * maxBlockSize), true);
+        headOutput.allocate((size_t) (channelCapacity * maxBlockSize), true);
+        headRendered = false;
+        renderedChannels = channelCapacity;
+        std::fill(fedSamples.begin(), fedSamples.end(), 0);
+        for (int stage = 1; stage < numOversamplingStages; stage++) {
+            auto factor = 1 << stage;
+            auto& bus = oversampledBuses[(size_t) stage];
+            bus.buffer.allocate((size_t) (channelCapacity * (factor * maxBlockSize + padFor(factor))), true);
+            for (auto& channelDecimators : bus.decimators) {
+                for (int halving = 0; halving < stage; halving++) {
+                    channelDecimators[(size_t) halving].prepare((factor >> halving) * maxBlockSize);
+                    channelDecimators[(size_t) halving].reset();
+                }
+            }
+            bus.flushSamples = 0;
+            bus.rendered = false;
+            bus.headRendered = false;
+        }
+    }
+
+    // Render groups on the worker pool when there are enough of them to be worth it
+    void setParallel(bool shouldRenderInParallel) {
+        parallel = shouldRenderInParallel;
+    }
+
+    void setSilenceThreshold(float gain) {
+        silenceThreshold = gain;
+    }
+
+    // Restarts the drum's sign flips from seed, so the strings started from here on flip
+    // the same way on every render
+    void setRandomSeed(juce::uint32 seed) {
+        randomSeed = seed;
+        stringsStarted = 0;
+    }
+
+    // Gain applied on every trip round the loop, at most 1. Shortens the decay of all
+    // strings without changing their tone.
+    void setLoopGain(float gain) {
+        loopGain = juce::jlimit(0.0f, 1.0f, gain);
+    }
+
+    // Probability of a loop sample keeping its sign: 1 for strings, 0.5 for drums
+    void setBlend(float probability) {
+        blend = juce::jlimit(0.0f, 1.0f, probability);
+    }
+
+    // Peak output level of the string over its most recently rendered chunk
+    float getPeakLevel(int index) const {
+        return peakLevel[index];
+    }
+
+    // Strings that decayed into silence during the last render() and have been stopped
+    const std::vector<int>& getFinishedStrings() const {
+        return finishedStrings;
+    }
+
+    void clearFinishedStrings() {
+        finishedStrings.clear();
+    }
+
+    int getNumStrings() const {
+        return (int) loops.size();
+    }
+
+    // stereoPosition runs from -1 (left) to 1 (right) and is ignored for mono output. The
+    // string is silent until offset samples into the next render(). An oversampling of 2 or
+    // 4 runs the string at that multiple of the sample rate, with loop and coefficient to match.
+    void startString(int index, StringBuffer& loop, float coefficient, const LoopFilters& loopFilters, float gain,
+                     float stereoPosition, int offset = 0, int oversampling = 1) {
+        loops[index] = &loop;
+        allPassCoefficient[index] = coefficient;
+        allPassTarget[index] = coefficient;
+        loopGainScale[index] = 1.0f;
+        resident[index] = false;
+        startOffset[index] = offset;
+        stopOffset[index] = notStopping;
+        releaseGain[index] = 1.0f;
+        releaseOffset[index] = notStopping;
+        injection[index] = nullptr;
+        fedSamples[index] = 0;
+        feedInput[index] = 0.0f;
+        feedOutput[index] = 0.0f;
+        filters[index] = loopFilters;
+        dampingTarget[index] = loopFilters.onePoleDamping ? loopFilters.damping : loopFilters.stretch;
+        rampOffset[index] = 0;
+        chain[index] = chainFor(loopFilters) + numChains * stageFor(oversampling);
+        lowPassState[index] = 0.0f;
+        std::fill_n(dispersionState.begin() + index * dispersionStateSize, dispersionStateSize, 0.0f);
+        levelState[index] = 0.0f;
+        allPassInput[index] = 0.0f;
+        allPassOutput[index] = 0.0f;
+        level[index] = gain;
+        pan[index] = stereoPosition;
+        peakLevel[index] = gain;
+        silentSamples[index] = 0;
+        randomState[index] = Random::seedFor(randomSeed + ++stringsStarted);
+        if (! active[index])
+            activeStrings.push_back(index);
+        active[index] = true;
+    }
+
+    // Retunes a sounding string at once, as when its loop's delay has been changed
+    // (which can be done directly between renders)
+    void setAllPassCoefficient(int index, float coefficient) {
+        allPassCoefficient[index] = coefficient;
+        allPassTarget[index] = coefficient;
+    }
+
+    // Retunes a sounding string gradually, reaching coefficient by the end of the next render()
+    void rampAllPassCoefficient(int index, float coefficient) {
+        allPassTarget[index] = coefficient;
+    }
+
+    // Multiplies the loop gain of one sounding string, until it is restarted
+    void setLoopGainScale(int index, float scale) {
+        loopGainScale[index] = juce::jlimit(0.0f, 1.0f, scale);
+    }
+
+    // A resident string keeps running through silence until it stops being resident or is stopped
+    void setResident(int index, bool shouldStayResident) {
+        resident[index] = shouldStayResident;
+    }
+
+    bool isOnePoleDamping(int index) const {
+        return filters[index].onePoleDamping;
+    }
+
+    // Moves the coefficient of a sounding string's damping lowpass, whichever kind it is,
+    // gradually, reaching coefficient by the end of the next render()
+    void rampDamping(int index, float coefficient) {
+        dampingTarget[index] = coefficient;
+    }
+
+    // Holds the next render()'s ramps of a sounding string until offset samples into it,
+    // where whatever moved them happened, and ramps over the rest of the block from there
+    void setRampOffset(int index, int offset) {
+        rampOffset[index] = juce::jmax(0, offset);
+    }
+
+    // Silences the string from offset samples into the next render(), after which it is
+    // stopped and reported through getFinishedStrings()
+    void stopStringAt(int index, int offset) {
+        if (active[index])
+            stopOffset[index] = juce::jmin(stopOffset[index], offset);
+    }
+
+    // Lets a sounding string die away from offset samples into the next render(), by
+    // multiplying its loop gain by gain (below 1) until it is retriggered. It finishes
+    // through getFinishedStrings() once it falls silent, like any other.
+    void releaseStringAt(int index, int offset, float gain) {
+        if (! active[index])
+            return;
+        nextReleaseGain[index] = juce::jlimit(0.0f, 1.0f, gain);
+        releaseOffset[index] = offset;
+    }
+
+    // Plucks a sounding string again from offset samples into the next render(), without
+    // resetting it: the getDelay() samples due out of excitation are added to what the loop
+    // is playing, so the old vibration carries on underneath. gain is the new note's level;
+    // excitation must stay untouched until they have all gone in. Cancels a release or stop.
+    void retriggerString(int index, const StringBuffer& excitation, float gain, int offset) {
+        if (! active[index])
+            return;
+        injection[index] = &excitation;
+        injectionStart[index] = offset;
+        injected[index] = 0;
+        injectionGain[index] = level[index] > 0.0f ? gain / level[index] : 0.0f;
+        nextReleaseGain[index] = 1.0f;
+        releaseOffset[index] = offset;
+        stopOffset[index] = notStopping;
+        silentSamples[index] = 0;
+    }
+
+    // Adds gain times source's latest numSamples to what comes out of a sounding string's
+    // loop over the next render(), from offset samples into it and on top of anything fed
+    // already. sourceOversampling is the rate multiple source runs at. Feeding the loop's
+    // output as it is read, chunk by chunk, reaches however short a loop across the whole
+    // block. Whatever falls beyond the end of the next render() is dropped.
+    void feedString(int index, const StringBuffer& source, int sourceOversampling, int offset, int numSamples,
+                    float gain) {
+        if (! active[index] || offset >= blockCapacity)
+            return;
+        numSamples = juce::jmin(numSamples, blockCapacity - offset);
+        if (numSamples <= 0)
+            return;
+        auto* samples = feedFor(index);
+        auto end = offset + numSamples;
+        if (end > fedSamples[index]) {
+            juce::FloatVectorOperations::clear(samples + fedSamples[index], end - fedSamples[index]);
+            fedSamples[index] = end;
+        }
+        source.addRecentTo(samples + offset, numSamples, gain, sourceOversampling);
+    }
+
+    int getOversampling(int index) const {
+        return 1 << (chain[index] / numChains);
+    }
+
+    // Where in the last render() a string started: 0 unless it was started for that one
+    int getLastStartOffset(int index) const {
+        return lastStartOffset[index];
+    }
+
+    // Renders a string's part of the next render() up to offset now, ahead of the others,
+    // for a string about to be stopped and started afresh within the block: a stolen one,
+    // say. Its output is held and added in by the next render() and addOversampled(), so
+    // the old note sounds up to offset and the new one from there. Stop the string next.
+    void renderStringUntil(int index, int offset) {
+        auto numChannels = juce::jmin(renderedChannels, channelCapacity);
+        offset = juce::jmin(offset, blockCapacity);
+        if (! active[index] || offset <= 0 || numChannels <= 0)
+            return;
+        auto position = (int) (std::find(activeStrings.begin(), activeStrings.end(), index) - activeStrings.begin());
+        auto stage = chain[index] / numChains;
+        auto factor = 1 << stage;
+        if (fedSamples[index] > 0)
+            blockFeedDc(index, juce::jmin(fedSamples[index], offset));
+        float* channels[maxGroupChannels] {};
+        if (stage == 0) {
+            for (int channel = 0; channel < numChannels; channel++) {
+                channels[channel] = headChannel(channel);
+                if (! headRendered)
+                    juce::FloatVectorOperations::clear(channels[channel], blockCapacity);
+            }
+            headRendered = true;
+            renderGroup({ position, 1, chain[index] }, channels, numChannels, 0, offset, chunk.data());
+        } else {
+            auto& bus = oversampledBuses[(size_t) stage];
+            auto pad = padFor(factor);
+            for (int channel = 0; channel < numChannels; channel++) {
+                channels[channel] = busChannel(stage, channel);
+                if (! bus.headRendered)
+                    juce::FloatVectorOperations::clear(channels[channel] + pad, factor * blockCapacity);
+            }
+            bus.headRendered = true;
+            renderGroup({ position, 1, chain[index] }, channels, numChannels, pad, factor * offset, chunk.data());
+        }
+    }
+
+    void stopString(int index) {
+        if (! active[index])
+            return;
+        active[index] = false;
+        activeStrings.erase(std::find(activeStrings.begin(), activeStrings.end(), index));
+    }
+
+    int getNumActiveStrings() const {
+        return (int) activeStrings.size();
+    }
+
+    bool isActive(int index) const {
+        return active[index];
+    }
+
+    // Adds the output of every active string to outputBuffer, the oversampled ones latency
+    // samples late
+    void render(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) {
+        renderStrings(outputBuffer, startSample, numSamples);
+        addOversampled(outputBuffer, startSample, numSamples);
+    }
+
+    // Renders every active string, adding the base rate ones to outputBuffer and leaving
+    // the oversampled ones decimated on their buses for addOversampled(). Each string is
+    // simulated once and placed in a stereo output with a constant power pan law.
+    void renderStrings(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) {
+        if (headRendered) {
+            for (int channel = 0; channel < juce::jmin(outputBuffer.getNumChannels(), channelCapacity); channel++)
+                juce::FloatVectorOperations::add(outputBuffer.getWritePointer(channel, startSample), headChannel(channel),
+                                                 juce::jmin(numSamples, blockCapacity));
+            headRendered = false;
+        }
+        renderedChannels = outputBuffer.getNumChannels();
+        for (auto index : activeStrings)
+            if (fedSamples[index] > 0)
+                blockFeedDc(index, juce::jmin(fedSamples[index], numSamples));
+        // Group strings by chain, and by similar length within a chain so one short loop
+        // doesn't chop up the chunks of several long ones
+        std::sort(activeStrings.begin(), activeStrings.end(), [this](int a, int b) {
+            if (chain[a] != chain[b])
+                return chain[a] < chain[b];
+            return loops[a]->getDelay() > loops[b]->getDelay();
+        });
+        groups.clear();
+        for (int first = 0; first < getNumActiveStrings();) {
+            auto groupChain = chain[activeStrings[first]];
+            auto count = 1;
+            while (count < lanes && first + count < getNumActiveStrings() && chain[activeStrings[first + count]] == groupChain)
+                count++;
+            groups.push_back({ first, count, groupChain });
+            first += count;
+        }
+        // Sorted by chain, so the base rate groups come first
+        auto numGroups = (int) groups.size();
+        auto numBaseGroups = 0;
+        while (numBaseGroups < numGroups && groups[(size_t) numBaseGroups].chain < numChains)
+            numBaseGroups++;
+        auto numChannels = outputBuffer.getNumChannels();
+
+        if (parallel && workers != nullptr && workers->isRunning() && numBaseGroups >= minParallelGroups
+            && numSamples >= minParallelSamples && numSamples <= blockCapacity && numChannels <= channelCapacity) {
+            ParallelRender job { this, numSamples, numChannels };
+            workers->run(numBaseGroups, renderGroupTask, &job);
+            for (int group = 0; group < numBaseGroups; group++)
+                for (int channel = 0; channel < numChannels; channel++)
+                    juce::FloatVectorOperations::add(outputBuffer.getWritePointer(channel, startSample),
+                                                     groupChannel(group, channel), numSamples);
+        } else {
+            auto* const* channels = outputBuffer.getArrayOfWritePointers();
+            for (int group = 0; group < numBaseGroups; group++)
+                renderGroup(groups[(size_t) group], channels, numChannels, startSample, numSamples, chunk.data());
+        }
+        renderOversampled(numBaseGroups, numChannels, numSamples);
+
+        for (auto index : activeStrings) {
+            lastStartOffset[index] = startOffset[index];
+            startOffset[index] = 0;
+            rampOffset[index] = 0;
+            fedSamples[index] = 0;
+            injectionStart[index] = 0;
+            if (releaseOffset[index] != notStopping) {
+                releaseGain[index] = nextReleaseGain[index];
+                releaseOffset[index] = notStopping;
+            }
+            if ((silentSamples[index] >= loops[index]->getDelay() && ! resident[index] && injection[index] == nullptr)
+                || stopOffset[index] != notStopping)
+                finishedStrings.push_back(index);
+        }
+        for (auto index : finishedStrings)
+            stopString(index);
+    }
+
+    // Adds the oversampled strings to outputBuffer. Call after every renderStrings(), with
+    // the same block.
+    void addOversampled(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) {
+        auto numChannels = juce::jmin(outputBuffer.getNumChannels(), channelCapacity);
+        for (int stage = 1; stage < numOversamplingStages; stage++) {
+            auto& bus = oversampledBuses[(size_t) stage];
+            if (! bus.rendered)
+                continue;
+            auto factor = 1 << stage;
+            auto pad = padFor(factor);
+            for (int channel = 0; channel < numChannels; channel++) {
+                auto* samples = busChannel(stage, channel);
+                juce::FloatVectorOperations::add(outputBuffer.getWritePointer(channel, startSample), samples, numSamples);
+                // The end of this block's high rate samples leads the next one
+                std::copy(samples + factor * numSamples, samples + factor * numSamples + pad, samples);
+            }
+            bus.rendered = false;
+        }
+    }
+
+    // Time for a string's fundamental to fall by decibels, given that the two-tap lowpass
+    // attenuates it by cos(pi * f / fs) on each trip round the loop
+    static double decayTimeSeconds(double frequency, double sampleRate, double decibels) {
+        auto lossPerPeriod = -20.0 * std::log10(std::cos(juce::MathConstants<double>::pi * frequency / sampleRate));
+        return decibels / (lossPerPeriod * frequency);
+    }
+
+private:
+    struct ParallelRender {
+        StringBank* bank;
+        int numSamples;
+        int numChannels;
+    };
+
+    static void renderGroupTask(void* context, int group, int workerIndex) {
+        auto& job = *static_cast<ParallelRender*>(context);
+        auto& bank = *job.bank;
+        float* channels[maxGroupChannels] {};
+        for (int channel = 0; channel < job.numChannels; channel++) {
+            channels[channel] = bank.groupChannel(group, channel);
+            juce::FloatVectorOperations::clear(channels[channel], job.numSamples);
+        }
+        auto* scratch = workerIndex == 0 ? bank.chunk.data() : bank.workerChunk(workerIndex);
+        bank.renderGroup(bank.groups[(size_t) group], channels, job.numChannels, 0, job.numSamples, scratch);
+    }
+
+    float* headChannel(int channel) {
+        return headOutput.get() + (size_t) (channel * blockCapacity);
+    }
+
+    float* groupChannel(int group, int channel) {
+        return groupOutput.get() + (size_t) ((group * channelCapacity + channel) * blockCapacity);
+    }
+
+    float* workerChunk(int workerIndex) {
+        auto* first = Vec::getNextSIMDAlignedPtr(workerChunks.get());
+        return first + (size_t) ((workerIndex - 1) * scratchCapacity);
+    }
+
+    // Up to lanes consecutive strings of activeStrings, all with the same chain
+    struct Group {
+        int first;
+        int count;
+        int chain;
+    };
+
+    // One more group than a full packing for every chain, at every rate, that can split one
+    static int maxGroupsFor(int numStrings) {
+        return (numStrings + lanes - 1) / lanes + numChains * numOversamplingStages - 1;
+    }
+
+    // Chains are numbered chainFor() + numChains * stageFor(oversampling)
+    static constexpr int numChains = 8;
+    static constexpr int numOversamplingStages = 3;   // 1x, 2x and 4x
+
+    static int chainFor(const LoopFilters& loopFilters) {
+        return (loopFilters.onePoleDamping ? 1 : 0) | (loopFilters.dispersion != 0.0f ? 2 : 0)
+             | (loopFilters.dynamicLevel < 1.0f ? 4 : 0);
+    }
+
+    static int stageFor(int oversampling) {
+        return oversampling >= 4 ? 2 : oversampling >= 2 ? 1 : 0;
+    }
+
+    // High rate samples a bus at factor is delayed before decimating, to make it latency late
+    static int padFor(int factor) {
+        return latency * factor - HalfBandDecimator::delay * (factor - 1);
+    }
+
+    float* busChannel(int stage, int channel) {
+        auto factor = 1 << stage;
+        return oversampledBuses[(size_t) stage].buffer.get()
+             + (size_t) (channel * (factor * blockCapacity + padFor(factor)));
+    }
+
+    // Renders the oversampled groups, from firstGroup on, into their buses, after the pad
+    // samples left from the last block, and decimates them in place for addOversampled().
+    // A bus keeps being decimated for a little while after its last string stops, so the
+    // pad and the filters' tails come out.
+    void renderOversampled(int firstGroup, int numChannels, int numSamples) {
+        auto group = firstGroup;
+        for (int stage = 1; stage < numOversamplingStages; stage++) {
+            auto& bus = oversampledBuses[(size_t) stage];
+            auto factor = 1 << stage;
+            auto lastGroup = group;
+            while (lastGroup < (int) groups.size() && groups[(size_t) lastGroup].chain / numChains == stage)
+                lastGroup++;
+            if (lastGroup == group && bus.flushSamples <= 0 && ! bus.headRendered)
+                continue;
+            if (numSamples > blockCapacity || numChannels > channelCapacity) {
+                jassertfalse;
+                group = lastGroup;
+                bus.headRendered = false;
+                continue;
+            }
+
+            auto stageGroups = lastGroup - group;
+            auto pad = padFor(factor);
+            float* channels[maxGroupChannels] {};
+            for (int channel = 0; channel < numChannels; channel++) {
+                channels[channel] = busChannel(stage, channel);
+                if (! bus.headRendered)
+                    juce::FloatVectorOperations::clear(channels[channel] + pad, factor * numSamples);
+            }
+            for (; group < lastGroup; group++)
+                renderGroup(groups[(size_t) group], channels, numChannels, pad, factor * numSamples, chunk.data());
+
+            for (int channel = 0; channel < numChannels; channel++) {
+                auto* samples = channels[channel];
+                for (int halving = 0; halving < stage; halving++)
+                    bus.decimators[(size_t) channel][(size_t) halving].process(samples, samples, (factor >> halving) * numSamples);
+            }
+            bus.rendered = true;
+            bus.flushSamples = stageGroups > 0 || bus.headRendered ? 2 * latency + 1 : bus.flushSamples - numSamples;
+            bus.headRendered = false;
+            if (bus.flushSamples <= 0)
+                for (auto& channelDecimators : bus.decimators)
+                    for (auto& decimator : channelDecimators)
+                        decimator.reset();
+        }
+    }
+
+    // Renders a group with the loop specialised for its chain, adding it to channels from
+    // outputStart and using scratch (chunkCapacity samples, then as many random numbers)
+    // as the chunk buffer. An oversampled group renders numSamples at its own rate.
+    void renderGroup(const Group& g, float* const* channels, int numChannels, int outputStart,
+                     int numSamples, float* scratch) {
+        using namespace LoopStage;
+        auto factor = 1 << (g.chain / numChains);
+        switch (g.chain % numChains) {
+            case 0: return renderGroupWith<LoopChain<StretchedAverage, NoDispersion, FullLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+            case 1: return renderGroupWith<LoopChain<OnePoleDamping, NoDispersion, FullLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+            case 2: return renderGroupWith<LoopChain<StretchedAverage, Dispersion, FullLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+            case 3: return renderGroupWith<LoopChain<OnePoleDamping, Dispersion, FullLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+            case 4: return renderGroupWith<LoopChain<StretchedAverage, NoDispersion, DynamicLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+            case 5: return renderGroupWith<LoopChain<OnePoleDamping, NoDispersion, DynamicLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+            case 6: return renderGroupWith<LoopChain<StretchedAverage, Dispersion, DynamicLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+            default: return renderGroupWith<LoopChain<OnePoleDamping, Dispersion, DynamicLevel>>(g, channels, numChannels, outputStart, numSamples, factor, scratch);
+        }
+    }
+
+    template <class Chain>
+    void renderGroupWith(const Group& group, float* const* channels, int numChannels, int outputStart,
+                         int numSamples, int factor, float* scratch) {
+        constexpr auto numStages = LoopStage::Dispersion<Vec>::numStages;
+        auto* indices = activeStrings.data() + group.first;
+        auto count = group.count;
+        alignas(Vec::SIMDRegisterSize) float a[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float aStep[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float d[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float dStep[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float lp[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float apIn[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float apOut[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float disp[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float dispIn[numStages][lanes] {};
+        alignas(Vec::SIMDRegisterSize) float dispOut[numStages][lanes] {};
+        alignas(Vec::SIMDRegisterSize) float lv[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float lvCoefficient[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float lvState[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float gainLeft[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float gainRight[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float loss[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float releasedLoss[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float threshold[lanes] {};
+        alignas(Vec::SIMDRegisterSize) float peak[lanes] {};
+        int starts[lanes] {};
+        int stops[lanes] {};
+        int releases[lanes] {};
+        int ramps[lanes] {};
+        auto stereo = numChannels == 2;
+        auto drum = blend < 1.0f;
+        Random random;
+
+        // Gather this group's state; unused lanes stay silent
+        for (int lane = 0; lane < count; lane++) {
+            auto index = indices[lane];
+            auto& f = filters[index];
+            starts[lane] = startOffset[index] * factor;
+            stops[lane] = stopOffset[index] == notStopping ? notStopping : stopOffset[index] * factor;
+            releases[lane] = releaseOffset[index] == notStopping ? notStopping : releaseOffset[index] * factor;
+            ramps[lane] = juce::jmin(rampOffset[index] * factor, numSamples);
+            auto rampLength = (float) juce::jmax(1, numSamples - ramps[lane]);
+            a[lane] = allPassCoefficient[index];
+            aStep[lane] = (allPassTarget[index] - a[lane]) / rampLength;
+            d[lane] = f.onePoleDamping ? f.damping : f.stretch;
+            dStep[lane] = (dampingTarget[index] - d[lane]) / rampLength;
+            lp[lane] = lowPassState[index];
+            loss[lane] = loopGain * loopGainScale[index] * releaseGain[index];
+            releasedLoss[lane] = loopGain * loopGainScale[index] * nextReleaseGain[index];
+            apIn[lane] = allPassInput[index];
+            apOut[lane] = allPassOutput[index];
+            if constexpr (Chain::dispersive) {
+                disp[lane] = f.dispersion;
+                auto* state = dispersionState.data() + index * dispersionStateSize;
+                for (int stage = 0; stage < numStages; stage++) {
+                    dispIn[stage][lane] = state[stage];
+                    dispOut[stage][lane] = state[numStages + stage];
+                }
+            }
+            if constexpr (Chain::dynamic) {
+                lv[lane] = f.dynamicLevel;
+                lvCoefficient[lane] = f.dynamicCoefficient;
+                lvState[lane] = levelState[index];
+            }
+            if (stereo) {
+                auto angle = (pan[index] + 1.0f) * juce::MathConstants<float>::pi / 4.0f;
+                gainLeft[lane] = level[index] * std::cos(angle);
+                gainRight[lane] = level[index] * std::sin(angle);
+            } else {
+                gainLeft[lane] = level[index];
+            }
+            // Compare the loop output itself against the threshold scaled by the string's level
+            threshold[lane] = level[index] > 0.0f ? silenceThreshold / level[index] : 1.0f;
+            random.state[lane] = randomState[index];
+        }
+        typename Chain::template Damping<Vec> damping { Vec::fromRawArray(d), Vec::fromRawArray(lp) };
+        typename Chain::template Dispersion<Vec> dispersion {};
+        typename Chain::template Level<Vec> dynamicLevel {};
+        if constexpr (Chain::dispersive) {
+            dispersion.coefficient = Vec::fromRawArray(disp);
+            for (int stage = 0; stage < numStages; stage++) {
+                dispersion.input[stage] = Vec::fromRawArray(dispIn[stage]);
+                dispersion.output[stage] = Vec::fromRawArray(dispOut[stage]);
+            }
+        }
+        if constexpr (Chain::dynamic)
+            dynamicLevel = { Vec::fromRawArray(lv), Vec::fromRawArray(lvCoefficient), Vec::fromRawArray(lvState) };
+        auto coefficient = Vec::fromRawArray(a);
+        auto coefficientStep = Vec::fromRawArray(aStep);
+        auto dampingStep = Vec::fromRawArray(dStep);
+        // Ramps held back to a later offset start flat
+        for (int lane = 0; lane < count; lane++) {
+            if (ramps[lane] > 0) {
+                coefficientStep.set((size_t) lane, 0.0f);
+                dampingStep.set((size_t) lane, 0.0f);
+            }
+        }
+        auto previousAllPassInput = Vec::fromRawArray(apIn);
+        auto previousAllPassOutput = Vec::fromRawArray(apOut);
+        auto gainsLeft = Vec::fromRawArray(gainLeft);
+        auto gainsRight = Vec::fromRawArray(gainRight);
+        auto gain = Vec::fromRawArray(loss);
+        auto thresholds = Vec::fromRawArray(threshold);
+        auto signBits = Vec::vMaskType::expand(0x80000000u);
+        auto blends = Vec::expand(blend);
+        auto* randomRows = scratch + chunkCapacity;
+
+        auto shortestLoop = maxChunkSize;
+        auto nextEvent = numSamples;
+        for (int lane = 0; lane < count; lane++) {
+            shortestLoop = juce::jmin(shortestLoop, loops[indices[lane]]->getReadAhead());
+            nextEvent = juce::jmin(nextEvent, stops[lane], releases[lane]);
+            if (ramps[lane] > 0)
+                nextEvent = juce::jmin(nextEvent, ramps[lane]);
+        }
+
+        for (int chunkStart = 0; chunkStart < numSamples; chunkStart += shortestLoop) {
+            auto chunkSize = juce::jmin(shortestLoop, numSamples - chunkStart);
+
+            // Interleave the loops' output so each row of chunk holds one sample per lane,
+            // with silence ahead of strings that haven't started yet
+            int skipped[lanes] {};
+            for (int lane = 0; lane < count; lane++) {
+                skipped[lane] = juce::jlimit(0, chunkSize, starts[lane] - chunkStart);
+                for (int i = 0; i < skipped[lane]; i++)
+                    scratch[i * lanes + lane] = 0.0f;
+                loops[indices[lane]]->read(scratch + skipped[lane] * lanes + lane, chunkSize - skipped[lane], lanes);
+            }
+            for (int lane = count; lane < lanes; lane++)
+                for (int i = 0; i < chunkSize; i++)
+                    scratch[i * lanes + lane] = 0.0f;
+            for (int lane = 0; lane < count; lane++) {
+                if (injection[indices[lane]] != nullptr)
+                    injectExcitation(indices[lane], lane, chunkStart, chunkSize, factor, scratch);
+                if (fedSamples[indices[lane]] * factor > chunkStart + skipped[lane])
+                    addFeed(indices[lane], lane, chunkStart, skipped[lane], chunkSize, factor, scratch);
+            }
+            if (drum)
+                random.fillUniform(randomRows, chunkSize * lanes);
+
+            auto chunkPeak = Vec::expand(0.0f);
+            for (int i = 0; i < chunkSize; i++) {
+                if (chunkStart + i == nextEvent)
+                    nextEvent = applyLaneEvents(nextEvent, stops, releases, ramps, releasedLoss, aStep, dStep, count,
+                                                gainsLeft, gainsRight, gain, coefficientStep, dampingStep, numSamples);
+                auto* row = scratch + i * lanes;
+                // Damping lowpass with the loop loss, negated at random for drums
+                auto damped = damping.process(Vec::fromRawArray(row)) * gain;
+                damping.ramp(dampingStep);
+                if (drum) {
+                    auto flip = Vec::greaterThanOrEqual(Vec::fromRawArray(randomRows + i * lanes), blends);
+                    damped = damped ^ (flip & signBits);
+                }
+                auto dispersed = dispersion.process(damped);
+                // First order allpass for the fractional part of the delay
+                auto output = coefficient * (dispersed - previousAllPassOutput) + previousAllPassInput;
+                previousAllPassInput = dispersed;
+                previousAllPassOutput = output;
+                coefficient += coefficientStep;
+                output.copyToRawArray(row);
+                chunkPeak = Vec::max(chunkPeak, Vec::abs(output));
+
+                auto heard = dynamicLevel.process(output);
+                auto outputIndex = outputStart + chunkStart + i;
+                if (stereo) {
+                    channels[0][outputIndex] += (heard * gainsLeft).sum();
+                    channels[1][outputIndex] += (heard * gainsRight).sum();
+                } else {
+                    auto mixed = (heard * gainsLeft).sum();
+                    for (int channel = 0; channel < numChannels; channel++)
+                        channels[channel][outputIndex] += mixed;
+                }
+            }
+
+            for (int lane = 0; lane < count; lane++)
+                loops[indices[lane]]->write(scratch + skipped[lane] * lanes + lane, chunkSize - skipped[lane], lanes);
+
+            chunkPeak.copyToRawArray(peak);
+            auto quiet = Vec::lessThan(chunkPeak, thresholds);
+            for (int lane = 0; lane < count; lane++) {
+                auto index = indices[lane];
+                peakLevel[index] = peak[lane] * level[index];
+                silentSamples[index] = quiet.get((size_t) lane) != 0 && skipped[lane] == 0 ? silentSamples[index] + chunkSize : 0;
+            }
+        }
+
+        damping.previous.copyToRawArray(lp);
+        previousAllPassInput.copyToRawArray(apIn);
+        previousAllPassOutput.copyToRawArray(apOut);
+        if constexpr (Chain::dispersive) {
+            for (int stage = 0; stage < numStages; stage++) {
+                dispersion.input[stage].copyToRawArray(dispIn[stage]);
+                dispersion.output[stage].copyToRawArray(dispOut[stage]);
+            }
+        }
+        if constexpr (Chain::dynamic)
+            dynamicLevel.previous.copyToRawArray(lvState);
+        for (int lane = 0; lane < count; lane++) {
+            auto index = indices[lane];
+            allPassCoefficient[index] = allPassTarget[index];
+            (filters[index].onePoleDamping ? filters[index].damping : filters[index].stretch) = dampingTarget[index];
+            lowPassState[index] = lp[lane];
+            allPassInput[index] = apIn[lane];
+            allPassOutput[index] = apOut[lane];
+            randomState[index] = random.state[lane];
+            if constexpr (Chain::dispersive) {
+                auto* state = dispersionState.data() + index * dispersionStateSize;
+                for (int stage = 0; stage < numStages; stage++) {
+                    state[stage] = dispIn[stage][lane];
+                    state[numStages + stage] = dispOut[stage][lane];
+                }
+            }
+            if constexpr (Chain::dynamic)
+                levelState[index] = lvState[lane];
+        }
+    }
+
+    // Zeroes the output gains of the lanes stopping at offset and moves the loop gains of
+    // those released or retriggered there, returning the offset of the next event
+    static int applyLaneEvents(int offset, const int* stops, const int* releases, const int* ramps,
+                               const float* releasedLoss, const float* coefficientSteps, const float* dampingSteps,
+                               int count, Vec& gainsLeft, Vec& gainsRight, Vec& loopGains,
+                               Vec& coefficientStep, Vec& dampingStep, int numSamples) {
+        auto next = numSamples;
+        for (int lane = 0; lane < count; lane++) {
+            if (ramps[lane] == offset) {
+                coefficientStep.set((size_t) lane, coefficientSteps[lane]);
+                dampingStep.set((size_t) lane, dampingSteps[lane]);
+            } else if (ramps[lane] > offset) {
+                next = juce::jmin(next, ramps[lane]);
+            }
+            if (stops[lane] == offset) {
+                gainsLeft.set((size_t) lane, 0.0f);
+                gainsRight.set((size_t) lane, 0.0f);
+            } else if (stops[lane] > offset) {
+                next = juce::jmin(next, stops[lane]);
+            }
+            if (releases[lane] == offset)
+                loopGains.set((size_t) lane, releasedLoss[lane]);
+            else if (releases[lane] > offset)
+                next = juce::jmin(next, releases[lane]);
+        }
+        return next;
+    }
+
+    // Adds the part of a retriggered string's excitation that falls in this chunk to its
+    // lane of the chunk, as it comes out of the loop
+    void injectExcitation(int index, int lane, int chunkStart, int chunkSize, int factor, float* scratch) {
+        auto first = juce::jmax(chunkStart, injectionStart[index] * factor);
+        auto& excitation = *injection[index];
+        auto numSamples = juce::jmin(chunkStart + chunkSize - first, excitation.getDelay() - injected[index]);
+        if (numSamples <= 0)
+            return;
+        excitation.addDue(scratch + (first - chunkStart) * lanes + lane, injected[index], numSamples, lanes,
+                          injectionGain[index]);
+        injected[index] += numSamples;
+        if (injected[index] >= excitation.getDelay())
+            injection[index] = nullptr;
+    }
+
+    // Adds the part of what was fed to a string that falls in this chunk to its lane, from
+    // where the string starts. An oversampled string holds each fed sample for factor rows.
+    void addFeed(int index, int lane, int chunkStart, int first, int chunkSize, int factor, float* scratch) {
+        auto* samples = feedFor(index);
+        auto last = juce::jmin(chunkSize, fedSamples[index] * factor - chunkStart);
+        for (int i = first; i < last; i++)
+            scratch[i * lanes + lane] += samples[(chunkStart + i) / factor];
+    }
+
+    // One pole DC blocker over a string's feed, carried on from one render() to the next, as
+    // the loop filters never lose DC
+    void blockFeedDc(int index, int numSamples) {
+        auto* samples = feedFor(index);
+        auto input = feedInput[index];
+        auto output = feedOutput[index];
+        for (int i = 0; i < numSamples; i++) {
+            output = samples[i] - input + feedDcPole * output;
+            input = samples[i];
+            samples[i] = output;
+        }
+        feedInput[index] = input;
+        feedOutput[index] = output;
+    }
+
+    float* feedFor(int index) {
+        return feed.get() + (size_t) (index * blockCapacity);
+    }
+
+    std::vector<StringBuffer*> loops;
+    std::vector<float> allPassCoefficient;
+    std::vector<float> allPassTarget;
+    std::vector<float> dampingTarget;      // where the damping coefficient ramps to, as allPassTarget
+    std::vector<int> rampOffset;           // where in the next render() both ramps start
+    std::vector<float> loopGainScale;
+    std::vector<bool> resident;
+    std::vector<LoopFilters> filters;
+    std::vector<int> chain;
+    std::vector<float> lowPassState;
+    std::vector<float> dispersionState;
+    std::vector<float> levelState;
+    std::vector<float> allPassInput;
+    std::vector<float> allPassOutput;
+    std::vector<float> level;
+    std::vector<float> pan;
+    std::vector<float> peakLevel;
+    std::vector<int> silentSamples;
+    std::vector<juce::uint32> randomState;
+    std::vector<int> startOffset;
+    std::vector<int> stopOffset;
+    std::vector<float> releaseGain;        // loop gain scale of a released string
+    std::vector<float> nextReleaseGain;    // and what it becomes at releaseOffset
+    std::vector<int> releaseOffset;
+    std::vector<const StringBuffer*> injection;   // excitation of a retriggered string
+    std::vector<int> injectionStart;
+    std::vector<int> injected;
+    std::vector<float> injectionGain;
+    std::vector<bool> active;
+    std::vector<int> activeStrings;
+    std::vector<int> finishedStrings;
+    std::vector<Group> groups;
+    float silenceThreshold = juce::Decibels::decibelsToGain(-90.0f);
+    float blend = 1.0f;
+    float loopGain = 1.0f;
+    juce::uint32 randomSeed = 0;
+    juce::uint32 stringsStarted = 0;
+
+    static constexpr int notStopping = std::numeric_limits<int>::max();
+    using Random = FastRandom<lanes>;
+    static constexpr int dispersionStateSize = 2 * LoopStage::Dispersion<float>::numStages;
+    static constexpr int chunkCapacity = maxChunkSize * lanes;
+    static constexpr float feedDcPole = 0.999f;
+    static constexpr int scratchCapacity = 2 * chunkCapacity;
+    static constexpr int maxGroupChannels = 8;
+    alignas(Vec::SIMDRegisterSize) std::array<float, scratchCapacity> chunk {};
+    juce::HeapBlock<float> workerChunks;
+    juce::HeapBlock<float> groupOutput;
+    juce::HeapBlock<float> feed;           // blockCapacity samples per string, see feedString()
+    std::vector<int> fedSamples;           // how far into its feed a string has been fed
+    std::vector<float> feedInput;          // DC blocker state, see blockFeedDc()
+    std::vector<float> feedOutput;
+    juce::HeapBlock<float> headOutput;     // see renderStringUntil()
+    bool headRendered = false;
+    int renderedChannels = 0;
+    std::vector<int> lastStartOffset;
+
+    // One per oversampling factor, index 0 unused. Each channel has a decimator per halving.
+    struct OversampledBus {
+        juce::HeapBlock<float> buffer;
+        std::array<std::array<HalfBandDecimator, numOversamplingStages - 1>, maxGroupChannels> decimators;
+        int flushSamples = 0;
+        bool rendered = false;       // holds a block addOversampled() hasn't added yet
+        bool headRendered = false;   // holds strings renderStringUntil() rendered ahead
+    };
+    std::array<OversampledBus, numOversamplingStages> oversampledBuses;
+    RenderWorkers* workers = nullptr;
+    int blockCapacity = 0;
+    int channelCapacity = 0;
+    bool parallel = false;
+};
+
+#endif /* StringBank_h */
@@ -0,0 +1,138 @@
+//
+//  StringScope.h
+//  KarplusStrong
+//
+//  Snapshots of the sounding strings' loops and the output, for the editor to draw.
+//  About thirty times a second the audio thread reads each active loop at a fixed
+//  number of points and copies the latest stretch of output into a ScopeFrame, then
+//  hands it over through a triple buffer. The editor never sees the strings themselves
+//  and the audio thread never waits for the editor.
+//
+
+#ifndef StringScope_h
+#define StringScope_h
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+
+// One writer and one reader swapping three copies of T. The writer always has a copy
+// to itself, the reader has the newest complete one, and the third is in between.
+// Neither side ever blocks or copies a T.
+template <typename T>
+class TripleBuffer {
+public:
+    // Writer: the copy to fill before publish()
+    T& getWriteBuffer() {
+        return slots[(size_t) back];
+    }
+
+    // Writer: makes the write buffer the newest, and takes the in-between copy to write next
+    void publish() {
+        back = middle.exchange(back | freshFlag, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Reader: the newest published copy, or nullptr if nothing has been published since
+    // the last call. Stays valid and unchanged until the next call.
+    const T* readLatest() {
+        if ((middle.load(std::memory_order_relaxed) & freshFlag) == 0)
+            return nullptr;
+        front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+        return &slots[(size_t) front];
+    }
+
+private:
+    static constexpr int indexMask = 3;
+    static constexpr int freshFlag = 4;
+
+    std::array<T, 3> slots {};
+    int back = 0;
+    std::atomic<int> middle { 1 };
+    int front = 2;
+};
+
+struct ScopeFrame {
+    static constexpr int maxStrings = 16;
+    static constexpr int pointsPerString = 128;
+    static constexpr int outputOrder = 11;
+    static constexpr int outputSize = 1 << outputOrder;
+
+    double sampleRate = 44100.0;
+    int numStrings = 0;
+    std::array<int, maxStrings> notes {};
+    std::array<std::array<float, pointsPerString>, maxStrings> strings {};  // each loop, oldest sample first
+    std::array<float, outputSize> output {};                                 // mono, oldest first
+};
+
+class StringScope {
+public:
+    static constexpr double frameRateHz = 30.0;
+
+    void prepare(double newSampleRate) {
+        sampleRate = newSampleRate;
+        samplesPerFrame = juce::jmax(1, (int) (sampleRate / frameRateHz));
+        samplesUntilFrame = 0;
+        ring.fill(0.0f);
+        ringPosition = 0;
+    }
+
+    // Reader side. Off by default, so nothing is captured while no one is looking.
+    void setEnabled(bool shouldCapture) {
+        enabled.store(shouldCapture, std::memory_order_relaxed);
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // Audio thread: keeps the last ScopeFrame::outputSize samples of the output, mixed to mono
+    void pushOutput(const juce::AudioBuffer<float>& buffer, int numSamples) {
+        auto numChannels = buffer.getNumChannels();
+        if (numChannels == 0)
+            return;
+        auto gain = 1.0f / (float) numChannels;
+        auto start = juce::jmax(0, numSamples - ScopeFrame::outputSize);
+        for (int i = start; i < numSamples; i++) {
+            float sum = 0.0f;
+            for (int channel = 0; channel < numChannels; channel++)
+                sum += buffer.getReadPointer(channel)[i];
+            ring[(size_t) ringPosition] = sum * gain;
+            ringPosition = (ringPosition + 1) & (ScopeFrame::outputSize - 1);
+        }
+    }
+
+    // Audio thread: a frame to fill with the strings if one is due after numSamples more
+    // samples, with the output already copied in, or nullptr. Follow with publishFrame().
+    ScopeFrame* startFrame(int numSamples) {
+        samplesUntilFrame -= numSamples;
+        if (samplesUntilFrame > 0)
+            return nullptr;
+        samplesUntilFrame += samplesPerFrame;
+        auto& frame = frames.getWriteBuffer();
+        frame.sampleRate = sampleRate;
+        auto firstRun = ScopeFrame::outputSize - ringPosition;
+        std::copy(ring.begin() + ringPosition, ring.end(), frame.output.begin());
+        std::copy(ring.begin(), ring.begin() + ringPosition, frame.output.begin() + firstRun);
+        return &frame;
+    }
+
+    void publishFrame() {
+        frames.publish();
+    }
+
+    // Reader side: see TripleBuffer::readLatest()
+    const ScopeFrame* readLatest() {
+        return frames.readLatest();
+    }
+
+private:
+    TripleBuffer<ScopeFrame> frames;
+    std::array<float, ScopeFrame::outputSize> ring {};
+    int ringPosition = 0;
+    double sampleRate = 44100.0;
+    int samplesPerFrame = 1;
+    int samplesUntilFrame = 0;
+    std::atomic<bool> enabled { false };
+};
+
+#endif /* StringScope_h */
@@ -0,0 +1,319 @@
+//
+//  SympatheticStrings.h
+//  KarplusStrong
+//
+//  Sympathetic resonance between strings. When a note starts it is linked, both ways, to
+//  the sounding strings whose partials line up with its own: a unison most strongly, then
+//  octaves, fifths and so on, each weaker the higher the partials that meet. Each string
+//  adds a small fraction of its output, from where it started, into what comes out of the
+//  loop of every string it is linked to, sample by sample as that loop is read. Open
+//  strings render after the voices and take their feed in the same block; a voice takes
+//  what was fed to it one block late, which at these weights only shifts the phase of a
+//  faint coupling.
+//
+//  Links only change on note events, and each string takes at most maxLinksPerString of
+//  them, so the per-block cost follows the number of coupled pairs rather than the square
+//  of the voice count. Each link is one scaled add of a block into a string's feed.
+//
+//  Feeding energy in would let a pair of linked loops, which lose almost nothing per trip,
+//  grow without bound. So each string's loop gain is lowered by the total weight of its
+//  incoming links, which keeps every row of the coupling matrix summing to at most 1.
+//
+//  Optionally there are open strings too, tuned like an instrument's and never played,
+//  that only sound by sympathy. They are resident while any played note is linked to one
+//  and ring out once none are; strings nothing is linked to aren't rendered at all. Left
+//  to the loop filter alone a low string would ring for minutes, so each has a loop gain
+//  that gives it openRingSeconds to fall by 60 dB.
+//
+
+#ifndef SympatheticStrings_h
+#define SympatheticStrings_h
+
+#include <JuceHeader.h>
+#include <array>
+#include <vector>
+#include "Utils.h"
+#include "StringBank.h"
+#include "RenderWorkers.h"
+#include "Tuning.h"
+
+class SympatheticStrings {
+public:
+    enum OpenTuning { none, guitar, harp };
+    static constexpr int maxOpenStrings = 22;
+    static constexpr int maxLinksPerString = 8;
+
+    static const juce::StringArray& openTuningNames() {
+        static const juce::StringArray names { "None", "Guitar", "Harp" };
+        return names;
+    }
+
+    explicit SympatheticStrings(StringBank& voiceBankToUse) : voiceBank(voiceBankToUse) {}
+
+    // Not real-time safe. Voice strings are numbered by voice, open strings after them.
+    void setNumVoices(int numVoicesToUse) {
+        numVoices = numVoicesToUse;
+        auto numStrings = numVoices + maxOpenStrings;
+        loops.assign((size_t) numStrings, nullptr);
+        pitches.assign((size_t) numStrings, 0.0f);
+        incomingWeight.assign((size_t) numStrings, 0.0f);
+        incomingLinks.assign((size_t) numStrings, 0);
+        member.assign((size_t) numStrings, false);
+        members.clear();
+        members.reserve((size_t) numStrings);
+        links.clear();
+        links.reserve((size_t) (numStrings * maxLinksPerString));
+        for (int open = 0; open < maxOpenStrings; open++)
+            loops[(size_t) (numVoices + open)] = &openLoops[(size_t) open];
+        openBank.setNumStrings(maxOpenStrings);
+        tuning = nullptr;
+        openTuning = none;
+    }
+
+    // Allocates the open strings' loops, long enough for the lowest of them at this rate.
+    // Call after setNumVoices() and once tuningTables are prepared; not real-time safe.
+    void prepare(double sampleRate, int maxBlockSize, int numChannels, RenderWorkers* workers,
+                 const TuningTables& tuningTables) {
+        auto capacity = StringBuffer::capacityFor((int) std::ceil(sampleRate / juce::MidiMessage::getMidiNoteInHertz(lowestOpenNote)));
+        openArena.allocate((size_t) (capacity * maxOpenStrings), true);
+        for (int open = 0; open < maxOpenStrings; open++)
+            openLoops[(size_t) open].setStorage(openArena.get() + (size_t) (open * capacity), capacity);
+        openBank.setNumStrings(maxOpenStrings);
+        openBank.prepare(maxBlockSize, numChannels, workers);
+        for (auto id : members)
+            member[(size_t) id] = false;
+        members.clear();
+        links.clear();
+        std::fill(incomingWeight.begin(), incomingWeight.end(), 0.0f);
+        std::fill(incomingLinks.begin(), incomingLinks.end(), 0);
+        tuning = &tuningTables;
+        openTuning = none;
+    }
+
+    void releaseResources() {
+        openBank.prepare(0, 0, nullptr);
+    }
+
+    // Weight of a unison link, from 0 (no coupling) to 1. Also scales links already made.
+    void setAmount(float newAmount) {
+        auto weight = maxWeight * juce::jlimit(0.0f, 1.0f, newAmount);
+        if (weight != unisonWeight) {
+            unisonWeight = weight;
+            updateLoopGains();
+        }
+    }
+
+    // Audio thread. Changing the tuning silences the old open strings.
+    void setOpenTuning(int newTuning) {
+        if (newTuning == openTuning || tuning == nullptr)
+            return;
+        for (int open = 0; open < maxOpenStrings; open++) {
+            removeString(numVoices + open);
+            openBank.stopString(open);
+            openLoops[(size_t) open].clear();
+        }
+        openBank.clearFinishedStrings();
+        openTuning = newTuning;
+        auto& notes = openNotesFor(openTuning);
+        for (size_t open = 0; open < notes.size(); open++) {
+            auto pitch = (float) notes[open];
+            // Plain two-tap average loops, whose filter delay is half a sample
+            auto loopLength = tuning->periodFor(pitch) - 0.5f;
+            auto delay = juce::jmin(TuningTables::delayFor(loopLength), openLoops[open].getMaximumDelay());
+            openLoops[open].setDelay(delay);
+            openCoefficients[open] = tuning->allPassCoefficientFor(loopLength - (float) delay, pitch);
+            auto frequency = juce::MidiMessage::getMidiNoteInHertz(notes[open]);
+            openLoopGains[open] = (float) std::pow(10.0, -3.0 / (openRingSeconds * frequency));
+            pitches[(size_t) numVoices + open] = pitch;
+            addMember(numVoices + (int) open);
+        }
+    }
+
+    // Links a voice's newly started string to the strings in tune with it. Does nothing
+    // while the amount is 0.
+    void addString(int voice, StringBuffer& loop, float pitch) {
+        if (unisonWeight <= 0.0f || member[(size_t) voice])
+            return;
+        loops[(size_t) voice] = &loop;
+        pitches[(size_t) voice] = pitch;
+        for (auto other : members) {
+            auto weight = harmonicWeight(pitch, pitches[(size_t) other]);
+            if (weight <= 0.0f)
+                continue;
+            auto linked = link(other, voice, weight);
+            linked = link(voice, other, weight) || linked;
+            if (linked && isOpen(other))
+                startOpenString(other - numVoices);
+        }
+        addMember(voice);
+        updateLoopGains();
+    }
+
+    // Unlinks a voice's string as it stops. Open strings left with no links ring out.
+    void removeString(int id) {
+        if (! member[(size_t) id])
+            return;
+        member[(size_t) id] = false;
+        members.erase(std::find(members.begin(), members.end(), id));
+        for (size_t i = 0; i < links.size();) {
+            auto& l = links[i];
+            if (l.from != id && l.to != id) {
+                i++;
+                continue;
+            }
+            incomingWeight[(size_t) l.to] -= l.weight;
+            incomingLinks[(size_t) l.to]--;
+            if (isOpen(l.to) && incomingLinks[(size_t) l.to] == 0)
+                openBank.setResident(l.to - numVoices, false);
+            l = links.back();
+            links.pop_back();
+        }
+        incomingWeight[(size_t) id] = 0.0f;
+        incomingLinks[(size_t) id] = 0;
+        updateLoopGains();
+    }
+
+    // After the voices have rendered numSamples: feeds the links into open strings, renders
+    // the open strings that are sounding into outputBuffer, then feeds the links into voices
+    void render(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples) {
+        if (links.empty() && openBank.getNumActiveStrings() == 0)
+            return;
+        feedLinks(numSamples, true);
+        openBank.render(outputBuffer, startSample, numSamples);
+        feedLinks(numSamples, false);
+        for (auto open : openBank.getFinishedStrings())
+            openLoops[(size_t) open].clear();
+        openBank.clearFinishedStrings();
+    }
+
+    int getNumLinks() const {
+        return (int) links.size();
+    }
+
+private:
+    struct Link {
+        int from;
+        int to;
+        float weight;   // relative to a unison
+    };
+
+    static constexpr float maxWeight = 0.003f;
+    static constexpr int maxPartial = 6;
+    static constexpr float toleranceCents = 15.0f;
+    static constexpr int lowestOpenNote = 40;
+    static constexpr float openLevel = 1.0f;
+    static constexpr double openRingSeconds = 6.0;
+
+    static const std::vector<int>& openNotesFor(int openTuning) {
+        static const std::vector<int> noNotes;
+        static const std::vector<int> guitarNotes { 40, 45, 50, 55, 59, 64 };
+        static const std::vector<int> harpNotes { 48, 50, 52, 53, 55, 57, 59, 60, 62, 64, 65,
+                                                  67, 69, 71, 72, 74, 76, 77, 79, 81, 83, 84 };
+        return openTuning == guitar ? guitarNotes : openTuning == harp ? harpNotes : noNotes;
+    }
+
+    // 1 for a unison, and 1 / (m * n) where partial m of the lower string meets partial n of
+    // the upper, fading to nothing as the two drift toleranceCents apart
+    static float harmonicWeight(float pitchA, float pitchB) {
+        auto cents = 100.0f * std::abs(pitchA - pitchB);
+        auto best = 0.0f;
+        for (int m = 1; m <= maxPartial; m++) {
+            for (int n = 1; n <= m; n++) {
+                auto detune = std::abs(cents - 1200.0f * std::log2((float) m / (float) n));
+                if (detune < toleranceCents)
+                    best = juce::jmax(best, (1.0f - detune / toleranceCents) / (float) (m * n));
+            }
+        }
+        return best;
+    }
+
+    bool isOpen(int id) const {
+        return id >= numVoices;
+    }
+
+    bool isSounding(int id) const {
+        return isOpen(id) ? openBank.isActive(id - numVoices) : voiceBank.isActive(id);
+    }
+
+    StringBank& bankFor(int id) {
+        return isOpen(id) ? openBank : voiceBank;
+    }
+
+    int indexFor(int id) const {
+        return isOpen(id) ? id - numVoices : id;
+    }
+
+    // Feeds what each source rendered this block, from where it started, into the links'
+    // open targets (toOpen) or voice targets. Open strings render after the voices, so they
+    // take it in the same block; voices take it from the same offsets in their next one.
+    void feedLinks(int numSamples, bool toOpen) {
+        for (auto& l : links) {
+            if (isOpen(l.to) != toOpen || ! isSounding(l.from) || ! isSounding(l.to))
+                continue;
+            auto& source = bankFor(l.from);
+            auto from = indexFor(l.from);
+            auto oversampling = source.getOversampling(from);
+            auto length = juce::jmin(numSamples - source.getLastStartOffset(from),
+                                     (loops[(size_t) l.from]->getMaximumDelay() + 1) / oversampling);
+            bankFor(l.to).feedString(indexFor(l.to), *loops[(size_t) l.from], oversampling, numSamples - length,
+                                     length, l.weight * unisonWeight);
+        }
+    }
+
+    void addMember(int id) {
+        member[(size_t) id] = true;
+        members.push_back(id);
+    }
+
+    // Skipped if the target already has its share of links
+    bool link(int from, int to, float weight) {
+        if (incomingLinks[(size_t) to] >= maxLinksPerString)
+            return false;
+        links.push_back({ from, to, weight });
+        incomingWeight[(size_t) to] += weight;
+        incomingLinks[(size_t) to]++;
+        return true;
+    }
+
+    void startOpenString(int open) {
+        if (! openBank.isActive(open)) {
+            openLoops[(size_t) open].clear();
+            openBank.startString(open, openLoops[(size_t) open], openCoefficients[(size_t) open], {}, openLevel, 0.0f);
+        }
+        openBank.setResident(open, true);
+    }
+
+    // On note events and amount changes only
+    void updateLoopGains() {
+        for (auto id : members) {
+            auto scale = 1.0f - unisonWeight * incomingWeight[(size_t) id];
+            if (isOpen(id)) {
+                if (openBank.isActive(id - numVoices))
+                    openBank.setLoopGainScale(id - numVoices, scale * openLoopGains[(size_t) (id - numVoices)]);
+            } else {
+                voiceBank.setLoopGainScale(id, scale);
+            }
+        }
+    }
+
+    StringBank& voiceBank;
+    StringBank openBank;
+    std::array<StringBuffer, maxOpenStrings> openLoops;
+    std::array<float, maxOpenStrings> openCoefficients {};
+    std::array<float, maxOpenStrings> openLoopGains {};
+    juce::HeapBlock<float> openArena;
+    const TuningTables* tuning = nullptr;
+    int openTuning = none;
+    int numVoices = 0;
+    float unisonWeight = 0.0f;
+
+    std::vector<StringBuffer*> loops;
+    std::vector<float> pitches;
+    std::vector<float> incomingWeight;
+    std::vector<int> incomingLinks;
+    std::vector<bool> member;
+    std::vector<int> members;
+    std::vector<Link> links;
+};
+
+#endif /* SympatheticStrings_h */
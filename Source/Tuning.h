@@ -0,0 +1,110 @@
+//
+//  Tuning.h
+//  KarplusStrong
+//
+//  Lookup tables for retuning strings while they sound. Pitch bend, glide and vibrato
+//  move every string's pitch each block, and working out the loop length and the tuning
+//  allpass coefficient directly would take a pow and two sins per string per block.
+//  These tables are built for the sample rate in prepare() and linearly interpolated.
+//
+//  Pitches are in fractional MIDI note numbers.
+//
+
+#ifndef Tuning_h
+#define Tuning_h
+
+#include <JuceHeader.h>
+#include <vector>
+
+class TuningTables {
+public:
+    static constexpr float lowestPitch = 0.0f;
+    static constexpr float highestPitch = 140.0f;
+
+    // Not real-time safe
+    void prepare(double sampleRate) {
+        periods.resize((size_t) (pitchRange * periodStepsPerSemitone + 2));
+        for (size_t i = 0; i < periods.size(); i++) {
+            auto pitch = lowestPitch + (double) i / periodStepsPerSemitone;
+            periods[i] = (float) (sampleRate / (440.0 * std::pow(2.0, (pitch - 69.0) / 12.0)));
+        }
+
+        coefficients.resize((size_t) ((pitchRange + 2) * (fractionSteps + 2)));
+        for (int note = 0; note <= pitchRange + 1; note++) {
+            auto omega = juce::MathConstants<double>::twoPi * 440.0 * std::pow(2.0, (lowestPitch + note - 69.0) / 12.0)
+                       / sampleRate;
+            for (int step = 0; step <= fractionSteps + 1; step++) {
+                auto fraction = maxFraction * step / fractionSteps;
+                auto coefficient = std::sin((1.0 - fraction) * omega / 2.0) / std::sin((1.0 + fraction) * omega / 2.0);
+                // Pitches near Nyquist have no sensible answer; keep the filter stable
+                coefficients[(size_t) (note * (fractionSteps + 2) + step)]
+                    = (float) (std::isfinite(coefficient) ? juce::jlimit(-maxCoefficient, maxCoefficient, coefficient) : 0.0);
+            }
+        }
+
+        sine.resize(sineSize + 1);
+        for (int i = 0; i <= sineSize; i++)
+            sine[(size_t) i] = (float) std::sin(juce::MathConstants<double>::twoPi * i / sineSize);
+    }
+
+    // Period in samples of a pitch
+    float periodFor(float pitch) const {
+        auto position = (juce::jlimit(lowestPitch, highestPitch, pitch) - lowestPitch) * periodStepsPerSemitone;
+        return interpolate(periods.data(), position);
+    }
+
+    // Allpass coefficient giving fraction samples (0 to maxFraction) of phase delay at the
+    // fundamental of pitch: sin((1 - fraction) w / 2) / sin((1 + fraction) w / 2)
+    float allPassCoefficientFor(float fraction, float pitch) const {
+        auto row = juce::jlimit(0.0f, (float) pitchRange, pitch - lowestPitch);
+        auto column = juce::jlimit(0.0f, (float) fractionSteps, fraction * fractionSteps / maxFraction);
+        auto note = (int) row;
+        auto* lower = coefficients.data() + note * (fractionSteps + 2);
+        auto below = interpolate(lower, column);
+        auto above = interpolate(lower + fractionSteps + 2, column);
+        return below + (above - below) * (row - (float) note);
+    }
+
+    // sin(2 pi phase) for phase in [0, 1)
+    float sineFor(float phase) const {
+        return interpolate(sine.data(), phase * sineSize);
+    }
+
+    static constexpr float maxFraction = 2.0f;
+
+    // Integer part of the loop delay for a string starting with a loop of loopLength
+    // samples, leaving the allpass a fraction a little over a third of a sample and up
+    static int delayFor(float loopLength) {
+        return juce::jmax(1, (int) std::floor(loopLength - centredFraction));
+    }
+
+    // Keeps currentDelay unless that would push the allpass fraction out of the range it
+    // tunes well, so small pitch movements don't keep hopping the integer delay
+    static int delayFor(float loopLength, int currentDelay) {
+        auto fraction = loopLength - (float) currentDelay;
+        if (minFraction <= fraction && fraction < maxKeptFraction)
+            return currentDelay;
+        return delayFor(loopLength);
+    }
+
+private:
+    static float interpolate(const float* table, float position) {
+        auto index = (int) position;
+        return table[index] + (table[index + 1] - table[index]) * (position - (float) index);
+    }
+
+    static constexpr float centredFraction = 0.35f;
+    static constexpr float minFraction = 0.1f;
+    static constexpr float maxKeptFraction = 1.6f;
+    static constexpr int pitchRange = (int) (highestPitch - lowestPitch);
+    static constexpr int periodStepsPerSemitone = 32;
+    static constexpr int fractionSteps = 128;
+    static constexpr int sineSize = 256;
+    static constexpr double maxCoefficient = 0.999;
+
+    std::vector<float> periods;
+    std::vector<float> coefficients;
+    std::vector<float> sine;
+};
+
+#endif /* Tuning_h */
@@ -8,54 +8,248 @@
 #ifndef Utils_h
 #define Utils_h
 
-class RingBuffer {
-    // will fail in the niche use case of 96kHz and notes below midi G-1 (24.5Hz)
-    std::array<float, 4096> buffer;
-    std::array<float, 4096> processingBuffer;
-    juce::AbstractFifo abstractFifo { 4096 };
-    juce::Random random;
+#include <vector>
+
+// Circular buffer holding one string's loop. The capacity is a power of two so wrapping
+// is a mask, and the integer loop delay is fixed between notes, so the loop can be read
+// and written in contiguous runs of up to getDelay() samples rather than one at a time.
+// The samples either live in memory handed over with setStorage(), so many strings can
+// share one allocation, or in the buffer's own vector after setMaximumDelay().
+class StringBuffer {
+    std::vector<float> ownStorage;
+    float* buffer = nullptr;
+    int mask = 0;
+    int writePosition = 0;
+    int delay = 0;
+    int written = 0;   // samples before writePosition that hold this note's loop, the rest stale
+    int fadeFrom = 0;       // the read tap being faded out by fadeToDelay()
+    int fadeLength = 0;
+    int fadeRemaining = 0;  // samples until only the tap at delay is heard
 public:
-    void reset() {
-        abstractFifo.reset();
-    }
-    void setSize(int newSize) {
-        abstractFifo.setTotalSize(newSize);
-    }
-    float nextSample() {
-        auto readHandle = abstractFifo.read(1);
-        if (readHandle.blockSize1 == 1) {
-            return buffer[readHandle.startIndex1];
-        } else {
-            return buffer[readHandle.startIndex2];
+    // Allocates - not for the audio thread
+    void setMaximumDelay(int maxDelay) {
+        ownStorage.assign((size_t) capacityFor(maxDelay), 0.0f);
+        setStorage(ownStorage.data(), (int) ownStorage.size());
+    }
+
+    // Uses capacity samples at storage, which must outlive the buffer (or the next call).
+    // capacity must be a power of two, as given by capacityFor().
+    void setStorage(float* storage, int capacity) {
+        jassert(juce::isPowerOfTwo(capacity));
+        buffer = storage;
+        mask = capacity - 1;
+        delay = juce::jmin(delay, mask);
+        clear();
+    }
+
+    // Smallest capacity that can hold a delay of maxDelay samples
+    static int capacityFor(int maxDelay) {
+        return juce::nextPowerOfTwo(juce::jmax(maxDelay + 1, 2));
+    }
+
+    int getMaximumDelay() const {
+        return mask;
+    }
+
+    // Stale samples a longer delay brings into the loop are zeroed
+    void setDelay(int newDelay) {
+        fadeRemaining = 0;
+        moveTap(newDelay);
+    }
+
+    // Moves the read tap to newDelay gradually: the next numSamples samples read crossfade
+    // from the old tap to the new, so a sounding loop changes length without a step. For a
+    // change of one sample that is linear interpolation sliding between the two delays.
+    void fadeToDelay(int newDelay, int numSamples) {
+        // Fading again mid-fade starts from whichever tap is louder
+        auto from = fadeRemaining * 2 > fadeLength ? fadeFrom : delay;
+        moveTap(newDelay);
+        fadeFrom = from;
+        fadeLength = numSamples;
+        fadeRemaining = from != delay ? juce::jmax(0, numSamples) : 0;
+    }
+
+    int getDelay() const {
+        return delay;
+    }
+
+    // How far ahead read() may go: getDelay(), or less while fading from a shorter delay
+    int getReadAhead() const {
+        return fadeRemaining > 0 ? juce::jmin(delay, fadeFrom) : delay;
+    }
+
+    void clear() {
+        if (buffer != nullptr)
+            std::fill(buffer, buffer + mask + 1, 0.0f);
+        writePosition = 0;
+        written = mask + 1;
+        fadeRemaining = 0;
+    }
+
+    // Silences the loop by zeroing just the getDelay() samples due out next, and marks the
+    // rest stale, for setDelay() to zero only if a longer delay reaches it. Costs the loop
+    // length rather than the whole capacity that clear() does.
+    void restart() {
+        written = 0;
+        fadeRemaining = 0;
+        if (buffer != nullptr)
+            setDelay(delay > 0 ? delay : 1);
+    }
+
+    // The sample written getDelay() samples ago. Read before writing the next one.
+    float popSample() const {
+        return buffer[(writePosition - delay) & mask];
+    }
+
+    void pushSample(float sample) {
+        buffer[writePosition] = sample;
+        writePosition = (writePosition + 1) & mask;
+    }
+
+    // Copies the next numSamples samples due out of the loop into dest, with a stride so
+    // several strings can be interleaved into one scratch buffer. numSamples <= getReadAhead().
+    void read(float* dest, int numSamples, int stride) const {
+        jassert(numSamples <= getReadAhead());
+        if (fadeRemaining > 0) {
+            auto from = writePosition - fadeFrom;
+            auto to = writePosition - delay;
+            for (int i = 0; i < numSamples; i++) {
+                auto fade = (float) juce::jmax(0, fadeRemaining - i) / (float) fadeLength;
+                auto next = buffer[(to + i) & mask];
+                dest[i * stride] = next + fade * (buffer[(from + i) & mask] - next);
+            }
+            return;
         }
+        auto position = (writePosition - delay) & mask;
+        auto firstRun = juce::jmin(numSamples, mask + 1 - position);
+        auto* source = buffer + position;
+        for (int i = 0; i < firstRun; i++)
+            dest[i * stride] = source[i];
+        source = buffer - firstRun;
+        for (int i = firstRun; i < numSamples; i++)
+            dest[i * stride] = source[i];
     }
-    
-    void writeSample(float sample) {
-        auto writeHandle = abstractFifo.write(1);
-        if (writeHandle.blockSize1 == 1) {
-            buffer[writeHandle.startIndex1] = sample;
-        } else {
-            buffer[writeHandle.startIndex2] = sample;
+
+    // numPoints samples spaced evenly round the loop, oldest first, for display
+    void readSpread(float* dest, int numPoints) const {
+        auto start = writePosition - delay;
+        for (int i = 0; i < numPoints; i++)
+            dest[i] = buffer[(start + i * delay / numPoints) & mask];
+    }
+
+    // Adds gain times numSamples of the samples due out, starting first samples in, to dest
+    // with a stride. first + numSamples <= getDelay().
+    void addDue(float* dest, int first, int numSamples, int stride, float gain) const {
+        jassert(first + numSamples <= delay);
+        auto position = writePosition - delay + first;
+        for (int i = 0; i < numSamples; i++)
+            dest[i * stride] += gain * buffer[(position + i) & mask];
+    }
+
+    // Appends numSamples strided samples from source to the loop
+    void write(const float* source, int numSamples, int stride) {
+        auto firstRun = juce::jmin(numSamples, mask + 1 - writePosition);
+        auto* dest = buffer + writePosition;
+        for (int i = 0; i < firstRun; i++)
+            dest[i] = source[i * stride];
+        dest = buffer - firstRun;
+        for (int i = firstRun; i < numSamples; i++)
+            dest[i] = source[i * stride];
+        writePosition = (writePosition + numSamples) & mask;
+        written = juce::jmin(written + numSamples, mask + 1);
+        fadeRemaining = juce::jmax(0, fadeRemaining - numSamples);
+    }
+
+    // Adds gain times the last numSamples samples written here to dest. A step above 1 takes
+    // every step-th of the last numSamples * step instead, as when this loop runs oversampled.
+    void addRecentTo(float* dest, int numSamples, float gain, int step = 1) const {
+        jassert(numSamples * step <= mask + 1);
+        if (numSamples <= 0)
+            return;
+        auto from = (writePosition - numSamples * step + step - 1) & mask;
+        if (step > 1) {
+            for (int i = 0; i < numSamples; i++)
+                dest[i] += gain * buffer[(from + i * step) & mask];
+            return;
+        }
+        while (numSamples > 0) {
+            auto run = juce::jmin(numSamples, mask + 1 - from);
+            juce::FloatVectorOperations::addWithMultiply(dest, buffer + from, gain, run);
+            dest += run;
+            from = (from + run) & mask;
+            numSamples -= run;
         }
     }
-    
-    void setImpulse(int loopSize) {
-        setSize(loopSize);
-        auto remaining_space = abstractFifo.getFreeSpace();
-        while(remaining_space--) {
-            writeSample((random.nextFloat() - 0.5) * 1.75);
+
+private:
+    void moveTap(int newDelay) {
+        jassert(0 < newDelay && newDelay <= mask);
+        delay = juce::jlimit(1, mask, newDelay);
+        if (delay > written) {
+            for (int i = written; i < delay; i++)
+                buffer[(writePosition - 1 - i) & mask] = 0.0f;
+            written = delay;
+        }
+    }
+};
+
+// xorshift32 generators running numStreams independent streams side by side. Each step is
+// a few shifts and xors over a small array of state, which compilers turn into SIMD
+// integer ops, so filling a block costs a fraction of calling juce::Random per value.
+template <int numStreams>
+struct FastRandom {
+    juce::uint32 state[numStreams];
+
+    explicit FastRandom(juce::uint32 seedValue = 1) {
+        seed(seedValue);
+    }
+
+    // Gives every stream a different, nonzero starting point
+    void seed(juce::uint32 seedValue) {
+        for (int stream = 0; stream < numStreams; stream++)
+            state[stream] = seedFor(seedValue + (juce::uint32) stream * 0x9e3779b9u);
+    }
+
+    // Scrambles a seed into a usable xorshift state (which must not be zero)
+    static juce::uint32 seedFor(juce::uint32 seedValue) {
+        seedValue ^= seedValue >> 16;
+        seedValue *= 0x7feb352du;
+        seedValue ^= seedValue >> 15;
+        seedValue *= 0x846ca68bu;
+        seedValue ^= seedValue >> 16;
+        return seedValue != 0 ? seedValue : 0x6b43a9b5u;
+    }
+
+    static juce::uint32 step(juce::uint32 x) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+
+    // numValues floats in [0, 1), taken a row of numStreams at a time
+    void fillUniform(float* dest, int numValues) {
+        fill(dest, numValues, 1.0f / 16777216.0f, 0.0f);
+    }
+
+    // numValues floats in [-1, 1)
+    void fillBipolar(float* dest, int numValues) {
+        fill(dest, numValues, 2.0f / 16777216.0f, -1.0f);
+    }
+
+private:
+    void fill(float* dest, int numValues, float scale, float offset) {
+        int i = 0;
+        for (; i + numStreams <= numValues; i += numStreams) {
+            for (int stream = 0; stream < numStreams; stream++) {
+                state[stream] = step(state[stream]);
+                dest[i + stream] = (float) (state[stream] >> 8) * scale + offset;
+            }
         }
-        filterImpulse(0.5);
-    }
-    
-    void filterImpulse(float pickPosition) {
-        auto size = abstractFifo.getTotalSize();
-        std::copy(buffer.cbegin(), buffer.cbegin() + size, processingBuffer.begin());
-        // make a big assumption - that after resetting the Fifo and setting a new size etc, read pointer will be at index 0
-        for (int i = 0; i < size; i++) {
-            processingBuffer[i] = buffer[i] - buffer[i - floor(pickPosition*size)];
+        for (int stream = 0; i < numValues; i++, stream++) {
+            state[stream] = step(state[stream]);
+            dest[i] = (float) (state[stream] >> 8) * scale + offset;
         }
-        std::copy(processingBuffer.cbegin(), processingBuffer.cbegin() + size, buffer.begin());
     }
 };
 
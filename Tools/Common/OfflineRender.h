@@ -0,0 +1,96 @@
+//
+//  OfflineRender.h
+//  KarplusStrong
+//
+//  Helpers shared by the headless tools for driving the processor without a host.
+//
+
+#ifndef OfflineRender_h
+#define OfflineRender_h
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include <functional>
+
+namespace OfflineRender {
+
+// Read every track of a MIDI file into one sequence, timestamped in seconds
+inline bool loadMidiFile(const juce::File& file, juce::MidiMessageSequence& sequence) {
+    juce::FileInputStream stream(file);
+    juce::MidiFile midiFile;
+    if (! stream.openedOk() || ! midiFile.readFrom(stream))
+        return false;
+
+    midiFile.convertTimestampTicksToSeconds();
+    sequence.clear();
+    for (int track = 0; track < midiFile.getNumTracks(); track++)
+        sequence.addSequence(*midiFile.getTrack(track), 0.0);
+    sequence.updateMatchedPairs();
+    return true;
+}
+
+// Set up the processor the way a host would before the first processBlock call
+inline void prepare(KarplusStrongAudioProcessor& processor, double sampleRate, int blockSize, int numChannels) {
+    processor.setPlayConfigDetails(0, numChannels, sampleRate, blockSize);
+    processor.setRateAndBufferSizeDetails(sampleRate, blockSize);
+    processor.prepareToPlay(sampleRate, blockSize);
+}
+
+// Copy the events falling in [blockStart, blockStart + numSamples) into a MidiBuffer.
+// nextEvent is the index of the first event not yet consumed and is advanced past them.
+inline void collectBlockEvents(const juce::MidiMessageSequence& sequence, int& nextEvent,
+                               juce::int64 blockStart, int numSamples, double sampleRate,
+                               juce::MidiBuffer& midi) {
+    midi.clear();
+    while (nextEvent < sequence.getNumEvents()) {
+        auto& message = sequence.getEventPointer(nextEvent)->message;
+        auto samplePosition = (juce::int64) std::llround(message.getTimeStamp() * sampleRate);
+        if (samplePosition >= blockStart + numSamples)
+            break;
+        auto offset = (int) juce::jlimit<juce::int64>(0, numSamples - 1, samplePosition - blockStart);
+        midi.addEvent(message, offset);
+        nextEvent++;
+    }
+}
+
+// Render the whole sequence plus tailSeconds of release block by block, handing each
+// block to output and then calling afterBlock (if given)
+inline juce::int64 renderSequence(KarplusStrongAudioProcessor& processor,
+                                  const juce::MidiMessageSequence& sequence,
+                                  double sampleRate, int blockSize, int numChannels, double tailSeconds,
+                                  const std::function<void(const juce::AudioBuffer<float>&)>& output,
+                                  const std::function<void()>& afterBlock = {}) {
+    auto totalSamples = (juce::int64) std::ceil((sequence.getEndTime() + tailSeconds) * sampleRate);
+    juce::AudioBuffer<float> buffer(numChannels, blockSize);
+    juce::MidiBuffer midi;
+    int nextEvent = 0;
+
+    for (juce::int64 position = 0; position < totalSamples; position += blockSize) {
+        auto numSamples = (int) juce::jmin<juce::int64>(blockSize, totalSamples - position);
+        juce::AudioBuffer<float> block(buffer.getArrayOfWritePointers(), numChannels, numSamples);
+        block.clear();
+        collectBlockEvents(sequence, nextEvent, position, numSamples, sampleRate, midi);
+        processor.processBlock(block, midi);
+        output(block);
+        if (afterBlock)
+            afterBlock();
+    }
+    return totalSamples;
+}
+
+// As above, writing the blocks to writer
+inline juce::int64 renderSequence(KarplusStrongAudioProcessor& processor,
+                                  const juce::MidiMessageSequence& sequence,
+                                  double sampleRate, int blockSize, int numChannels,
+                                  double tailSeconds, juce::AudioFormatWriter& writer,
+                                  const std::function<void()>& afterBlock = {}) {
+    return renderSequence(processor, sequence, sampleRate, blockSize, numChannels, tailSeconds,
+                          [&writer](const juce::AudioBuffer<float>& block) {
+                              writer.writeFromAudioSampleBuffer(block, 0, block.getNumSamples());
+                          },
+                          afterBlock);
+}
+
+}
+
+#endif /* OfflineRender_h */
@@ -0,0 +1,207 @@
+//
+//  Main.cpp
+//  KsBench
+//
+//  Measures the cost of KarplusStrongAudioProcessor::processBlock across voice counts,
+//  block sizes, sample rates, pick positions and loop filter chains. Reports ns per output
+//  sample and the real-time factor (seconds of audio rendered per second of CPU).
+//  With --regress, checks renders against golden audio and stored timings instead, and
+//  with --notes, reports each note's cost and tuning under each oversampling setting.
+//
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "OfflineRender.h"
+#include "Regression.h"
+#include "NoteCost.h"
+
+struct BenchConfig {
+    double sampleRate;
+    int blockSize;
+    int numVoices;
+    float pickPosition;
+    juce::String chain;
+};
+
+struct BenchResult {
+    double nsPerSample;
+    double realTimeFactor;
+};
+
+static juce::Array<double> parseList(const juce::ArgumentList& args, const juce::String& option,
+                                     const juce::String& defaults) {
+    auto text = args.containsOption(option) ? args.getValueForOption(option) : defaults;
+    juce::Array<double> values;
+    for (auto& token : juce::StringArray::fromTokens(text, ",", {}))
+        if (token.trim().isNotEmpty())
+            values.add(token.trim().getDoubleValue());
+    return values;
+}
+
+// Spread the chord over a few octaves so short and long loops are both represented.
+// Repeats go on other channels, as the synth retriggers a note already sounding on a channel.
+static int noteForVoice(int voice) {
+    return 28 + (voice * 7) % 60;
+}
+
+static int channelForVoice(int voice) {
+    return 1 + (voice / 60) % 16;
+}
+
+// Loop filter chains by name; "average" is the original two-tap average and allpass
+static const juce::StringArray chainNames { "average", "onepole", "stiff", "dynamic", "full" };
+
+static void setChain(KarplusStrongAudioProcessor& processor, const juce::String& chain) {
+    *processor.damping = (chain == "onepole" || chain == "full") ? 1 : 0;
+    *processor.stiffness = (chain == "stiff" || chain == "full") ? 0.5f : 0.0f;
+    *processor.dynamics = (chain == "dynamic" || chain == "full") ? 0.5f : 0.0f;
+}
+
+static BenchResult runBenchmark(const BenchConfig& config, double seconds, int numChannels) {
+    KarplusStrongAudioProcessor processor;
+    *processor.maxVoices = config.numVoices;
+    *processor.pickPosition = config.pickPosition;
+    setChain(processor, config.chain);
+    OfflineRender::prepare(processor, config.sampleRate, config.blockSize, numChannels);
+
+    juce::AudioBuffer<float> buffer(numChannels, config.blockSize);
+    juce::MidiBuffer midi;
+    for (int voice = 0; voice < config.numVoices; voice++)
+        midi.addEvent(juce::MidiMessage::noteOn(channelForVoice(voice), noteForVoice(voice), 0.8f), 0);
+
+    // The note-ons (and their excitation) happen in an untimed warm-up block
+    buffer.clear();
+    processor.processBlock(buffer, midi);
+    midi.clear();
+
+    auto numBlocks = juce::jmax(1, (int) std::ceil(seconds * config.sampleRate / config.blockSize));
+    auto start = std::chrono::steady_clock::now();
+    for (int block = 0; block < numBlocks; block++) {
+        buffer.clear();
+        processor.processBlock(buffer, midi);
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    processor.releaseResources();
+
+    auto numSamples = (double) numBlocks * config.blockSize;
+    return { elapsed * 1.0e9 / numSamples, (numSamples / config.sampleRate) / elapsed };
+}
+
+int main(int argc, char* argv[]) {
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::ArgumentList args(argc, argv);
+
+    if (args.containsOption("--help|-h")) {
+        std::cout << "Usage: KsBench [options]\n"
+                     "  --rates <list>     sample rates (default 44100,48000,96000,192000)\n"
+                     "  --blocks <list>    block sizes (default 32,64,128,256,512,1024,2048,4096)\n"
+                     "  --voices <list>    simultaneous voices, up to 256 (default 1,6,16,64,256)\n"
+                     "  --picks <list>     pick positions (default 0.1,0.5,0.9)\n"
+                     "  --chains <list>    loop filter chains out of average, onepole, stiff, dynamic\n"
+                     "                     and full (default average)\n"
+                     "  --seconds <s>      audio rendered per measurement (default 1)\n"
+                     "  --channels <n>     output channels (default 2)\n"
+                     "  --csv <file>       also write the results as CSV\n"
+                     "  --regress <dir>    render the regression scenarios with a fixed seed and compare\n"
+                     "                     them with <dir>/<scenario>.wav and <dir>/timings.csv\n"
+                     "  --update           with --regress, write the golden audio and timings instead\n"
+                     "  --audio-only       with --regress, render each scenario once and leave the\n"
+                     "                     timings alone\n"
+                     "  --tolerance <x>    largest sample difference from the golden audio (default 1e-4)\n"
+                     "  --slowdown <pct>   allowed ns/sample increase over timings.csv (default 10)\n"
+                     "  --repeats <n>      timed renders per scenario, the fastest counting (default 3)\n"
+                     "  --notes <list>     play each note alone, at the first of --rates and --blocks, and\n"
+                     "                     report its ns/sample and how many cents out of tune it is\n"
+                     "  --oversampling <list>\n"
+                     "                     with --notes, the most oversampling to allow: 1, 2 or 4\n"
+                     "                     (default 1,2,4)\n";
+        return 0;
+    }
+
+    if (args.containsOption("--regress")) {
+        Regression::Settings settings;
+        settings.directory = args.getFileForOption("--regress");
+        settings.update = args.containsOption("--update");
+        if (args.containsOption("--tolerance"))
+            settings.tolerance = args.getValueForOption("--tolerance").getFloatValue();
+        if (args.containsOption("--slowdown"))
+            settings.allowedSlowdown = args.getValueForOption("--slowdown").getDoubleValue();
+        if (args.containsOption("--repeats"))
+            settings.repeats = args.getValueForOption("--repeats").getIntValue();
+        if (args.containsOption("--audio-only")) {
+            settings.timings = false;
+            settings.repeats = 1;
+        }
+        return Regression::run(settings) == 0 ? 0 : 1;
+    }
+
+    if (args.containsOption("--notes")) {
+        NoteCost::Settings settings;
+        settings.notes = parseList(args, "--notes", {});
+        settings.factors = parseList(args, "--oversampling", "1,2,4");
+        if (args.containsOption("--rates"))
+            settings.sampleRate = parseList(args, "--rates", {}).getFirst();
+        if (args.containsOption("--blocks"))
+            settings.blockSize = (int) parseList(args, "--blocks", {}).getFirst();
+        if (args.containsOption("--seconds"))
+            settings.seconds = args.getValueForOption("--seconds").getDoubleValue();
+        NoteCost::run(settings);
+        return 0;
+    }
+
+    auto rates = parseList(args, "--rates", "44100,48000,96000,192000");
+    auto blocks = parseList(args, "--blocks", "32,64,128,256,512,1024,2048,4096");
+    auto voices = parseList(args, "--voices", "1,6,16,64,256");
+    auto picks = parseList(args, "--picks", "0.1,0.5,0.9");
+    auto chains = juce::StringArray::fromTokens(args.containsOption("--chains") ? args.getValueForOption("--chains")
+                                                                               : juce::String("average"), ",", {});
+    chains.trim();
+    chains.removeEmptyStrings();
+    for (auto& chain : chains) {
+        if (! chainNames.contains(chain)) {
+            std::cerr << "Unknown chain " << chain << "\n";
+            return 1;
+        }
+    }
+    auto seconds = args.containsOption("--seconds") ? args.getValueForOption("--seconds").getDoubleValue() : 1.0;
+    auto numChannels = args.containsOption("--channels") ? args.getValueForOption("--channels").getIntValue() : 2;
+
+    std::unique_ptr<juce::FileOutputStream> csv;
+    if (args.containsOption("--csv")) {
+        auto csvFile = juce::File::getCurrentWorkingDirectory().getChildFile(args.getValueForOption("--csv"));
+        csvFile.deleteFile();
+        csv = csvFile.createOutputStream();
+        if (csv != nullptr)
+            *csv << "sample_rate,block_size,voices,pick_position,chain,ns_per_sample,realtime_factor\n";
+    }
+
+    std::cout << juce::String("rate").paddedLeft(' ', 8) << juce::String("block").paddedLeft(' ', 7)
+              << juce::String("voices").paddedLeft(' ', 8) << juce::String("pick").paddedLeft(' ', 6)
+              << juce::String("chain").paddedLeft(' ', 9)
+              << juce::String("ns/sample").paddedLeft(' ', 12) << juce::String("x realtime").paddedLeft(' ', 12)
+              << "\n";
+
+    for (auto rate : rates) {
+        for (auto block : blocks) {
+            for (auto voiceCount : voices) {
+                for (auto pick : picks) {
+                    for (auto& chain : chains) {
+                        BenchConfig config { rate, (int) block, (int) voiceCount, (float) pick, chain };
+                        auto result = runBenchmark(config, seconds, numChannels);
+                        std::cout << juce::String((int) rate).paddedLeft(' ', 8)
+                                  << juce::String(config.blockSize).paddedLeft(' ', 7)
+                                  << juce::String(config.numVoices).paddedLeft(' ', 8)
+                                  << juce::String(pick, 2).paddedLeft(' ', 6)
+                                  << chain.paddedLeft(' ', 9)
+                                  << juce::String(result.nsPerSample, 1).paddedLeft(' ', 12)
+                                  << juce::String(result.realTimeFactor, 1).paddedLeft(' ', 12) << "\n";
+                        if (csv != nullptr)
+                            *csv << (int) rate << "," << config.blockSize << "," << config.numVoices << ","
+                                 << pick << "," << chain << "," << result.nsPerSample << "," << result.realTimeFactor << "\n";
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
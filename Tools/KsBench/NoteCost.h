@@ -0,0 +1,121 @@
+//
+//  NoteCost.h
+//  KsBench
+//
+//  What oversampling buys and costs, note by note. Each note is played alone under each
+//  oversampling setting, timed over a sustained stretch after the note-on, and its
+//  fundamental measured against equal temperament. The pitch comes from the phase advance
+//  at the expected frequency between two Hann windowed stretches, which resolves a small
+//  fraction of a cent in a few thousand samples.
+//
+
+#ifndef NoteCost_h
+#define NoteCost_h
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "OfflineRender.h"
+#include <chrono>
+#include <complex>
+
+namespace NoteCost {
+
+struct Settings {
+    double sampleRate = 48000.0;
+    int blockSize = 512;
+    double seconds = 1.0;           // rendered and timed per note, after the note-on block
+    juce::Array<double> notes;
+    juce::Array<double> factors;    // the most each run may oversample: 1, 2 or 4
+};
+
+struct Result {
+    int factor = 1;                 // what the note was actually rendered at
+    double nsPerSample = 0.0;
+    double cents = 0.0;
+    bool audible = false;
+};
+
+constexpr int windowSize = 2048;
+constexpr int hop = 256;
+constexpr double settleSeconds = 0.05; // skip the attack before measuring
+
+// Complex amplitude of samples at frequency, Hann windowed, with phase relative to sample 0
+inline std::complex<double> demodulate(const float* samples, int start, double frequency, double sampleRate) {
+    std::complex<double> sum;
+    for (int i = 0; i < windowSize; i++) {
+        auto window = 0.5 - 0.5 * std::cos(juce::MathConstants<double>::twoPi * i / windowSize);
+        auto phase = -juce::MathConstants<double>::twoPi * frequency * (start + i) / sampleRate;
+        sum += window * samples[start + i] * std::polar(1.0, phase);
+    }
+    return sum;
+}
+
+inline Result measure(int note, int maxFactor, const Settings& settings) {
+    KarplusStrongAudioProcessor processor;
+    *processor.maxVoices = 1;
+    *processor.oversampling = maxFactor >= 4 ? 2 : maxFactor >= 2 ? 1 : 0;
+    OfflineRender::prepare(processor, settings.sampleRate, settings.blockSize, 1);
+
+    KsNoteParameters parameters;
+    parameters.maxOversampling = 1 << processor.oversampling->getIndex();
+    parameters.oversamplingNote = processor.oversamplingNote->get();
+    Result result;
+    result.factor = KsVoice::oversamplingFor(parameters, note);
+
+    juce::AudioBuffer<float> buffer(1, settings.blockSize);
+    juce::MidiBuffer midi;
+    midi.addEvent(juce::MidiMessage::noteOn(1, note, 0.8f), 0);
+    buffer.clear();
+    processor.processBlock(buffer, midi);
+    midi.clear();
+
+    auto numBlocks = juce::jmax(1, (int) std::ceil(settings.seconds * settings.sampleRate / settings.blockSize));
+    juce::AudioBuffer<float> output(1, numBlocks * settings.blockSize);
+    std::chrono::duration<double> elapsed {};
+    for (int block = 0; block < numBlocks; block++) {
+        buffer.clear();
+        auto start = std::chrono::steady_clock::now();
+        processor.processBlock(buffer, midi);
+        elapsed += std::chrono::steady_clock::now() - start;
+        output.copyFrom(0, block * settings.blockSize, buffer, 0, 0, settings.blockSize);
+    }
+    processor.releaseResources();
+    result.nsPerSample = elapsed.count() * 1.0e9 / output.getNumSamples();
+
+    auto start = (int) (settleSeconds * settings.sampleRate);
+    if (start + hop + windowSize > output.getNumSamples())
+        return result;
+    auto expected = juce::MidiMessage::getMidiNoteInHertz(note);
+    auto* samples = output.getReadPointer(0);
+    auto first = demodulate(samples, start, expected, settings.sampleRate);
+    auto second = demodulate(samples, start + hop, expected, settings.sampleRate);
+    result.audible = std::abs(first) > 1.0e-6 && std::abs(second) > 1.0e-6;
+    if (result.audible) {
+        auto measured = expected + std::arg(second / first) * settings.sampleRate
+                                 / (juce::MathConstants<double>::twoPi * hop);
+        result.cents = 1200.0 * std::log2(measured / expected);
+    }
+    return result;
+}
+
+// One row per note and oversampling setting
+inline void run(const Settings& settings) {
+    std::cout << juce::String("note").paddedLeft(' ', 6) << juce::String("max").paddedLeft(' ', 5)
+              << juce::String("used").paddedLeft(' ', 6) << juce::String("ns/sample").paddedLeft(' ', 12)
+              << juce::String("cents").paddedLeft(' ', 9) << "\n";
+    for (auto note : settings.notes) {
+        for (auto factor : settings.factors) {
+            auto result = measure(juce::jlimit(0, 127, (int) note), (int) factor, settings);
+            std::cout << juce::String((int) note).paddedLeft(' ', 6)
+                      << (juce::String((int) factor) + "x").paddedLeft(' ', 5)
+                      << (juce::String(result.factor) + "x").paddedLeft(' ', 6)
+                      << juce::String(result.nsPerSample, 1).paddedLeft(' ', 12)
+                      << (result.audible ? juce::String(result.cents, 2) : juce::String("-")).paddedLeft(' ', 9)
+                      << "\n";
+        }
+    }
+}
+
+}
+
+#endif /* NoteCost_h */
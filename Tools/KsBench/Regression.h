@@ -0,0 +1,265 @@
+//
+//  Regression.h
+//  KsBench
+//
+//  Golden-audio and performance regression checks. A fixed set of scenarios - generated
+//  MIDI with a few parameter settings each - is rendered through processBlock with a fixed
+//  seed, rate and block size, so every run produces the same audio. Each render is
+//  compared against a stored 32-bit float WAV, and its best time over a few runs against
+//  a stored ns per sample, so a change that alters the sound or slows a scenario down
+//  fails the run.
+//
+//  The golden audio lives in Tests/Regression and is checked by CTest with --audio-only.
+//  Timings depend on the machine, so timings.csv is kept out of the repository and only
+//  checked where it was recorded.
+//
+
+#ifndef Regression_h
+#define Regression_h
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "OfflineRender.h"
+#include <chrono>
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace Regression {
+
+struct Settings {
+    juce::File directory;            // holds <scenario>.wav and timings.csv
+    bool update = false;             // write the references instead of checking against them
+    float tolerance = 1.0e-4f;       // largest sample difference allowed from the golden audio
+    double allowedSlowdown = 10.0;   // percent above the stored ns per sample
+    int repeats = 3;                 // timed renders per scenario; the fastest counts
+    bool timings = true;             // check or write timings.csv as well as the audio
+};
+
+constexpr double sampleRate = 48000.0;
+constexpr int blockSize = 512;
+constexpr int numChannels = 2;
+constexpr double tailSeconds = 2.0;
+constexpr juce::int64 seed = 1;
+
+enum class Pattern { arpeggio, strum, repeated, dense };
+
+struct Scenario {
+    const char* name;
+    Pattern pattern;
+    std::vector<std::pair<const char*, float>> parameters;   // plain values
+};
+
+inline const std::vector<Scenario>& scenarios() {
+    static const std::vector<Scenario> list {
+        { "pluck", Pattern::arpeggio, {} },
+        { "strum", Pattern::strum, { { "stereoSpread", 0.8f } } },
+        { "drum", Pattern::repeated, { { "blend", 0.5f }, { "decay", 0.985f } } },
+        { "fullChain", Pattern::arpeggio, { { "damping", 1.0f }, { "stiffness", 0.5f }, { "dynamics", 0.5f } } },
+        { "sympathetic", Pattern::strum, { { "coupling", 1.0f }, { "openStrings", 1.0f } } },
+        { "glide", Pattern::arpeggio, { { "glideTime", 0.1f }, { "vibratoDepth", 0.3f } } },
+        { "stealing", Pattern::dense, { { "maxVoices", 16.0f } } },
+        { "body", Pattern::strum, { { "body", (float) BodyResonance::acoustic }, { "bodyMix", 0.7f } } },
+    };
+    return list;
+}
+
+inline juce::MidiMessageSequence makeSequence(Pattern pattern) {
+    juce::MidiMessageSequence sequence;
+    auto addNote = [&sequence](int note, float velocity, double start, double length) {
+        sequence.addEvent(juce::MidiMessage::noteOn(1, note, velocity).withTimeStamp(start));
+        sequence.addEvent(juce::MidiMessage::noteOff(1, note).withTimeStamp(start + length));
+    };
+    switch (pattern) {
+        case Pattern::arpeggio:
+            for (int i = 0; i < 16; i++)
+                addNote(40 + (i * 7) % 36, 0.5f + 0.03f * (float) i, 0.25 * i, 0.2);
+            break;
+        case Pattern::strum:
+            for (int chord = 0; chord < 3; chord++)
+                for (int string = 0; string < 6; string++)
+                    addNote(40 + 5 * string + 2 * chord, 0.8f - 0.05f * (float) string,
+                            1.5 * chord + 0.015 * string, 1.2);
+            break;
+        case Pattern::repeated:
+            for (int i = 0; i < 24; i++)
+                addNote(i % 2 == 0 ? 45 : 52, i % 4 == 0 ? 1.0f : 0.6f, 0.125 * i, 0.1);
+            break;
+        case Pattern::dense:
+            for (int i = 0; i < 96; i++)
+                addNote(28 + (i * 11) % 72, 0.4f + 0.006f * (float) i, 0.03 * i, 1.0);
+            break;
+    }
+    sequence.updateMatchedPairs();
+    return sequence;
+}
+
+struct Result {
+    bool ok = true;
+    juce::String message;
+    double nsPerSample = 0.0;
+};
+
+// Renders scenario on a fresh processor into output, returning the time spent in processBlock
+inline double render(const Scenario& scenario, juce::AudioBuffer<float>& output) {
+    KarplusStrongAudioProcessor processor;
+    processor.setNonRealtime(true);
+    for (auto& [id, value] : scenario.parameters) {
+        auto* parameter = processor.parameters.getParameter(id);
+        jassert(parameter != nullptr);
+        parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+    }
+    OfflineRender::prepare(processor, sampleRate, blockSize, numChannels);
+    processor.setRandomSeed(seed);
+
+    auto sequence = makeSequence(scenario.pattern);
+    output.setSize(numChannels, (int) std::ceil((sequence.getEndTime() + tailSeconds) * sampleRate));
+    int position = 0;
+    auto start = std::chrono::steady_clock::now();
+    OfflineRender::renderSequence(processor, sequence, sampleRate, blockSize, numChannels, tailSeconds,
+                                  [&output, &position](const juce::AudioBuffer<float>& block) {
+                                      for (int channel = 0; channel < numChannels; channel++)
+                                          output.copyFrom(channel, position, block, channel, 0, block.getNumSamples());
+                                      position += block.getNumSamples();
+                                  });
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    processor.releaseResources();
+    return elapsed;
+}
+
+inline bool writeWav(const juce::File& file, const juce::AudioBuffer<float>& audio) {
+    file.deleteFile();
+    std::unique_ptr<juce::OutputStream> stream(file.createOutputStream());
+    if (stream == nullptr)
+        return false;
+    juce::WavAudioFormat wav;
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        wav.createWriterFor(stream.get(), sampleRate, (unsigned int) audio.getNumChannels(), 32, {}, 0));
+    if (writer == nullptr)
+        return false;
+    stream.release();
+    return writer->writeFromAudioSampleBuffer(audio, 0, audio.getNumSamples());
+}
+
+inline bool readWav(const juce::File& file, juce::AudioBuffer<float>& audio) {
+    if (! file.existsAsFile())
+        return false;
+    juce::WavAudioFormat wav;
+    std::unique_ptr<juce::AudioFormatReader> reader(wav.createReaderFor(file.createInputStream().release(), true));
+    if (reader == nullptr)
+        return false;
+    audio.setSize((int) reader->numChannels, (int) reader->lengthInSamples);
+    return reader->read(&audio, 0, audio.getNumSamples(), 0, true, true);
+}
+
+// Largest difference between two renders, and where it is
+inline float compare(const juce::AudioBuffer<float>& a, const juce::AudioBuffer<float>& b, int& worstSample) {
+    float worst = 0.0f;
+    worstSample = 0;
+    for (int channel = 0; channel < a.getNumChannels(); channel++) {
+        auto* x = a.getReadPointer(channel);
+        auto* y = b.getReadPointer(channel);
+        for (int i = 0; i < a.getNumSamples(); i++) {
+            auto difference = std::abs(x[i] - y[i]);
+            if (difference > worst) {
+                worst = difference;
+                worstSample = i;
+            }
+        }
+    }
+    return worst;
+}
+
+// scenario,ns_per_sample
+inline std::map<juce::String, double> readTimings(const juce::File& file) {
+    std::map<juce::String, double> timings;
+    juce::StringArray lines;
+    file.readLines(lines);
+    for (int i = 1; i < lines.size(); i++) {
+        auto fields = juce::StringArray::fromTokens(lines[i], ",", {});
+        if (fields.size() >= 2)
+            timings[fields[0].trim()] = fields[1].getDoubleValue();
+    }
+    return timings;
+}
+
+inline bool writeTimings(const juce::File& file, const std::vector<Result>& results) {
+    juce::String text("scenario,ns_per_sample\n");
+    for (size_t i = 0; i < results.size(); i++)
+        text << scenarios()[i].name << "," << juce::String(results[i].nsPerSample, 2) << "\n";
+    return file.replaceWithText(text);
+}
+
+// Runs every scenario, printing one line each. Returns the number that failed.
+inline int run(const Settings& settings) {
+    if (settings.update && ! settings.directory.createDirectory()) {
+        std::cerr << "Could not create " << settings.directory.getFullPathName() << "\n";
+        return 1;
+    }
+    auto timingsFile = settings.directory.getChildFile("timings.csv");
+    auto storedTimings = readTimings(timingsFile);
+    std::vector<Result> results;
+    int failures = 0;
+
+    for (auto& scenario : scenarios()) {
+        Result result;
+        juce::AudioBuffer<float> audio;
+        auto fastest = std::numeric_limits<double>::max();
+        for (int repeat = 0; repeat < juce::jmax(1, settings.repeats); repeat++)
+            fastest = juce::jmin(fastest, render(scenario, audio));
+        result.nsPerSample = fastest * 1.0e9 / audio.getNumSamples();
+
+        auto golden = settings.directory.getChildFile(juce::String(scenario.name) + ".wav");
+        if (settings.update) {
+            result.ok = writeWav(golden, audio);
+            result.message = result.ok ? "written" : "could not write " + golden.getFullPathName();
+        } else {
+            juce::AudioBuffer<float> reference;
+            int worstSample = 0;
+            if (! readWav(golden, reference)) {
+                result.ok = false;
+                result.message = "no golden audio at " + golden.getFullPathName();
+            } else if (reference.getNumChannels() != audio.getNumChannels()
+                       || reference.getNumSamples() != audio.getNumSamples()) {
+                result.ok = false;
+                result.message = "length or channels differ from the golden audio";
+            } else {
+                auto error = compare(audio, reference, worstSample);
+                result.ok = error <= settings.tolerance;
+                result.message = "max error " + juce::String(juce::Decibels::gainToDecibels(error, -200.0f), 1) + " dB";
+                if (! result.ok)
+                    result.message << " at sample " << worstSample;
+            }
+
+            auto stored = storedTimings.find(scenario.name);
+            if (settings.timings && stored != storedTimings.end() && stored->second > 0.0) {
+                auto change = 100.0 * (result.nsPerSample / stored->second - 1.0);
+                result.message << ", " << (change >= 0.0 ? "+" : "") << juce::String(change, 1) << "% time";
+                if (change > settings.allowedSlowdown) {
+                    result.ok = false;
+                    result.message << " (over " << juce::String(settings.allowedSlowdown, 1) << "%)";
+                }
+            }
+        }
+
+        std::cout << juce::String(scenario.name).paddedRight(' ', 14)
+                  << juce::String(result.nsPerSample, 1).paddedLeft(' ', 10) << " ns/sample  "
+                  << (result.ok ? "ok    " : "FAILED") << "  " << result.message << "\n";
+        if (! result.ok)
+            failures++;
+        results.push_back(result);
+    }
+
+    if (settings.update && settings.timings && ! writeTimings(timingsFile, results)) {
+        std::cerr << "Could not write " << timingsFile.getFullPathName() << "\n";
+        failures++;
+    }
+    std::cout << (failures == 0 ? "All " + juce::String(results.size()) + " scenarios passed"
+                                : juce::String(failures) + " of " + juce::String(results.size()) + " scenarios failed")
+              << "\n";
+    return failures;
+}
+
+}
+
+#endif /* Regression_h */
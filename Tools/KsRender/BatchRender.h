@@ -0,0 +1,315 @@
+//
+//  BatchRender.h
+//  KsRender
+//
+//  Renders a manifest of MIDI files concurrently, one job per file. Each job gets its own
+//  processor, prepared and seeded the same way whichever worker picks it up, so the audio
+//  is bit-identical to rendering the manifest on one thread. Blocks go to the file through
+//  a juce::AudioFormatWriter::ThreadedWriter with a fixed-size FIFO, drained by a shared
+//  background thread, so memory stays flat however long the files are.
+//
+//  The parallelism is across files, so each job's processor has parallelRender forced off,
+//  whatever the manifest says, and its synth starts no render workers of its own.
+//
+//  checkRepeatable() renders a manifest on one worker and then on several, into a scratch
+//  directory, and compares the files byte for byte.
+//
+//  Manifest lines are
+//      <input.mid> <output.wav|.flac> [parameterID=value ...]
+//  with paths relative to the manifest and values in the parameter's own units. seed=n
+//  overrides the batch seed for one file. Blank lines and lines starting with # are skipped.
+//
+
+#ifndef BatchRender_h
+#define BatchRender_h
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "OfflineRender.h"
+#include <atomic>
+#include <vector>
+
+namespace BatchRender {
+
+struct Settings {
+    double sampleRate = 48000.0;
+    int blockSize = 512;
+    int numChannels = 2;
+    double tailSeconds = 2.0;
+    int bitDepth = 24;
+    int numWorkers = 1;
+    juce::int64 seed = 1;
+    int writerBufferSamples = 32768;   // per file, in the ThreadedWriter's FIFO
+};
+
+struct Job {
+    juce::File input;
+    juce::File output;
+    juce::StringPairArray parameters;
+    int line = 0;
+};
+
+struct Result {
+    bool ok = false;
+    juce::String error;
+    juce::int64 numSamples = 0;
+    double seconds = 0.0;
+};
+
+// Parses the manifest into jobs, or returns an error naming the offending line
+inline juce::String parseManifest(const juce::File& manifest, std::vector<Job>& jobs) {
+    if (! manifest.existsAsFile())
+        return "Could not read manifest " + manifest.getFullPathName();
+    juce::StringArray lines;
+    manifest.readLines(lines);
+    auto directory = manifest.getParentDirectory();
+    for (int i = 0; i < lines.size(); i++) {
+        auto line = lines[i].trim();
+        if (line.isEmpty() || line.startsWithChar('#'))
+            continue;
+        auto tokens = juce::StringArray::fromTokens(line, " \t", "\"");
+        tokens.removeEmptyStrings();
+        if (tokens.size() < 2)
+            return "Manifest line " + juce::String(i + 1) + ": expected <input.mid> <output file>";
+        Job job;
+        job.input = directory.getChildFile(tokens[0].unquoted());
+        job.output = directory.getChildFile(tokens[1].unquoted());
+        job.line = i + 1;
+        for (int t = 2; t < tokens.size(); t++) {
+            if (! tokens[t].containsChar('='))
+                return "Manifest line " + juce::String(i + 1) + ": expected parameterID=value, got " + tokens[t];
+            job.parameters.set(tokens[t].upToFirstOccurrenceOf("=", false, false),
+                               tokens[t].fromFirstOccurrenceOf("=", false, false));
+        }
+        jobs.push_back(job);
+    }
+    return {};
+}
+
+// Sets the processor's parameters from a job, leaving out seed
+inline juce::String applyParameters(KarplusStrongAudioProcessor& processor, const juce::StringPairArray& parameters) {
+    for (auto& id : parameters.getAllKeys()) {
+        if (id == "seed")
+            continue;
+        auto* parameter = processor.parameters.getParameter(id);
+        if (parameter == nullptr)
+            return "unknown parameter " + id;
+        parameter->setValueNotifyingHost(parameter->convertTo0to1(parameters[id].getFloatValue()));
+    }
+    return {};
+}
+
+// Passes writes through to a file and remembers whether any failed, since the
+// ThreadedWriter drops the results of the writes it makes in the background. The last
+// check is when the writer deletes the stream, after it has finished the file's header.
+class CheckedFileStream: public juce::OutputStream {
+public:
+    CheckedFileStream(std::unique_ptr<juce::FileOutputStream> fileToUse, std::atomic<bool>& failedFlag)
+        : file(std::move(fileToUse)), failed(failedFlag) {}
+
+    ~CheckedFileStream() override {
+        file->flush();
+        check(file->getStatus().wasOk());
+    }
+
+    void flush() override {
+        file->flush();
+        check(file->getStatus().wasOk());
+    }
+
+    bool setPosition(juce::int64 newPosition) override {
+        return check(file->setPosition(newPosition));
+    }
+
+    juce::int64 getPosition() override {
+        return file->getPosition();
+    }
+
+    bool write(const void* data, size_t numBytes) override {
+        return check(file->write(data, numBytes));
+    }
+
+private:
+    bool check(bool ok) {
+        if (! ok)
+            failed = true;
+        return ok;
+    }
+
+    std::unique_ptr<juce::FileOutputStream> file;
+    std::atomic<bool>& failed;
+};
+
+// writeFailed is set if writing the file goes wrong at any point, and must outlive the writer
+inline std::unique_ptr<juce::AudioFormatWriter> createWriter(const juce::File& file, const Settings& settings,
+                                                             std::atomic<bool>& writeFailed, juce::String& error) {
+    std::unique_ptr<juce::AudioFormat> format;
+    if (file.hasFileExtension("flac"))
+        format = std::make_unique<juce::FlacAudioFormat>();
+    else
+        format = std::make_unique<juce::WavAudioFormat>();
+    file.getParentDirectory().createDirectory();
+    file.deleteFile();
+    std::unique_ptr<juce::FileOutputStream> fileStream(file.createOutputStream());
+    if (fileStream == nullptr || fileStream->failedToOpen()) {
+        error = "could not open " + file.getFullPathName() + " for writing";
+        return nullptr;
+    }
+    auto stream = std::make_unique<CheckedFileStream>(std::move(fileStream), writeFailed);
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        format->createWriterFor(stream.get(), settings.sampleRate, (unsigned int) settings.numChannels,
+                                settings.bitDepth, {}, 0));
+    if (writer == nullptr) {
+        error = "unsupported output format for " + file.getFileName();
+        return nullptr;
+    }
+    stream.release();
+    return writer;
+}
+
+inline Result renderJob(const Job& job, const Settings& settings, juce::TimeSliceThread& writerThread) {
+    Result result;
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+    juce::MidiMessageSequence sequence;
+    if (! OfflineRender::loadMidiFile(job.input, sequence)) {
+        result.error = "could not read MIDI file " + job.input.getFullPathName();
+        return result;
+    }
+
+    KarplusStrongAudioProcessor processor;
+    processor.setNonRealtime(true);
+    result.error = applyParameters(processor, job.parameters);
+    if (result.error.isNotEmpty())
+        return result;
+    *processor.parallelRender = false;
+    OfflineRender::prepare(processor, settings.sampleRate, settings.blockSize, settings.numChannels);
+    processor.setRandomSeed(job.parameters.getAllKeys().contains("seed") ? job.parameters["seed"].getLargeIntValue()
+                                                               : settings.seed);
+
+    std::atomic<bool> writeFailed { false };
+    auto writer = createWriter(job.output, settings, writeFailed, result.error);
+    if (writer == nullptr)
+        return result;
+    {
+        // Destroying the ThreadedWriter flushes its FIFO and closes the file
+        juce::AudioFormatWriter::ThreadedWriter threadedWriter(writer.release(), writerThread,
+                                                               settings.writerBufferSamples);
+        result.numSamples = OfflineRender::renderSequence(
+            processor, sequence, settings.sampleRate, settings.blockSize, settings.numChannels, settings.tailSeconds,
+            [&threadedWriter](const juce::AudioBuffer<float>& block) {
+                // Waits for the writer to catch up rather than growing the FIFO
+                while (! threadedWriter.write(block.getArrayOfReadPointers(), block.getNumSamples()))
+                    juce::Thread::sleep(1);
+            });
+    }
+    processor.releaseResources();
+    if (writeFailed) {
+        result.error = "could not write all of " + job.output.getFullPathName();
+        job.output.deleteFile();
+        return result;
+    }
+    result.ok = true;
+    result.seconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    return result;
+}
+
+// Renders every job on settings.numWorkers threads, printing each file as it finishes and a
+// summary at the end. Returns the number of jobs that failed.
+inline int run(const std::vector<Job>& jobs, const Settings& settings) {
+    juce::TimeSliceThread writerThread("KsRender writer");
+    writerThread.startThread();
+    juce::ThreadPool pool(juce::jmax(1, settings.numWorkers));
+    std::vector<Result> results(jobs.size());
+    std::atomic<int> finished { 0 };
+    juce::CriticalSection printLock;
+    juce::WaitableEvent allFinished;
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pool.addJob([&, i] {
+            results[i] = renderJob(jobs[i], settings, writerThread);
+            auto count = ++finished;
+            {
+                const juce::ScopedLock sl(printLock);
+                auto& result = results[i];
+                std::cout << "[" << count << "/" << jobs.size() << "] ";
+                if (result.ok)
+                    std::cout << jobs[i].output.getFileName() << ": " << result.numSamples / settings.sampleRate
+                              << " s of audio in " << result.seconds << " s\n";
+                else
+                    std::cout << "line " << jobs[i].line << " failed: " << result.error << "\n";
+            }
+            if (count == (int) jobs.size())
+                allFinished.signal();
+        });
+    }
+    if (! jobs.empty())
+        allFinished.wait();
+    writerThread.stopThread(10000);
+
+    auto elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    int failures = 0;
+    double audioSeconds = 0.0;
+    juce::int64 bytes = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (! results[i].ok) {
+            failures++;
+            continue;
+        }
+        audioSeconds += results[i].numSamples / settings.sampleRate;
+        bytes += jobs[i].output.getSize();
+    }
+    std::cout << "Rendered " << (int) jobs.size() - failures << " of " << jobs.size() << " files on "
+              << pool.getNumThreads() << " workers: " << audioSeconds << " s of audio in " << elapsedSeconds
+              << " s (" << audioSeconds / juce::jmax(elapsedSeconds, 1.0e-9) << "x real time, "
+              << bytes / (1024.0 * 1024.0) / juce::jmax(elapsedSeconds, 1.0e-9) << " MB/s written)\n";
+    return failures;
+}
+
+// The jobs with their output written to directory instead, numbered so names can't clash
+inline std::vector<Job> redirect(const std::vector<Job>& jobs, const juce::File& directory) {
+    auto redirected = jobs;
+    for (size_t i = 0; i < redirected.size(); i++)
+        redirected[i].output = directory.getChildFile(juce::String((int) i) + "-" + jobs[i].output.getFileName());
+    return redirected;
+}
+
+// Renders every job once on a single worker and once on settings.numWorkers (at least
+// two), and checks the two sets of files are byte for byte the same. Returns the number
+// of jobs that failed or differ. The scratch files are deleted afterwards.
+inline int checkRepeatable(const std::vector<Job>& jobs, const Settings& settings) {
+    auto scratch = juce::File::getSpecialLocation(juce::File::tempDirectory)
+                       .getNonexistentChildFile("KsRender-check", {}, false);
+    auto serialJobs = redirect(jobs, scratch.getChildFile("serial"));
+    auto parallelJobs = redirect(jobs, scratch.getChildFile("parallel"));
+    auto serialSettings = settings;
+    serialSettings.numWorkers = 1;
+    auto parallelSettings = settings;
+    parallelSettings.numWorkers = juce::jmax(2, settings.numWorkers);
+
+    std::cout << "Rendering on 1 worker\n";
+    auto failures = run(serialJobs, serialSettings);
+    std::cout << "Rendering on " << parallelSettings.numWorkers << " workers\n";
+    failures += run(parallelJobs, parallelSettings);
+
+    int differing = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (! serialJobs[i].output.existsAsFile() || ! parallelJobs[i].output.existsAsFile())
+            continue;
+        if (! serialJobs[i].output.hasIdenticalContentTo(parallelJobs[i].output)) {
+            std::cout << "line " << jobs[i].line << ": " << jobs[i].output.getFileName()
+                      << " differs between 1 and " << parallelSettings.numWorkers << " workers\n";
+            differing++;
+        }
+    }
+    scratch.deleteRecursively();
+    std::cout << (failures + differing == 0 ? juce::String("All files identical")
+                                            : juce::String(differing) + " files differ, " + juce::String(failures)
+                                                  + " renders failed")
+              << "\n";
+    return failures + differing;
+}
+
+}
+
+#endif /* BatchRender_h */
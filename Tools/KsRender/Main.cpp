@@ -0,0 +1,137 @@
+//
+//  Main.cpp
+//  KsRender
+//
+//  Offline renderer: drives KarplusStrongAudioProcessor::processBlock from a MIDI file
+//  and writes the result to a WAV file, or renders a whole manifest of files in parallel.
+//
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "OfflineRender.h"
+#include "BatchRender.h"
+
+static void printUsage() {
+    std::cout << "Usage: KsRender <input.mid> <output.wav> [options]\n"
+                 "       KsRender --batch <manifest.txt> [options]\n"
+                 "  --rate <Hz>        sample rate (default 48000)\n"
+                 "  --block <samples>  block size (default 512)\n"
+                 "  --channels <n>     1 or 2 output channels (default 2)\n"
+                 "  --pick <0..1>      pick position (default 0.5)\n"
+                 "  --tail <seconds>   extra time rendered after the last event (default 2)\n"
+                 "  --bits <n>         WAV bit depth (default 24)\n"
+                 "  --seed <n>         seed the excitation noise, so renders repeat exactly\n"
+                 "  --perf <file.csv>  write per-block timings and voice counts to a CSV file\n"
+                 "  --batch <file>     render every line of a manifest: <input.mid> <output.wav|.flac>\n"
+                 "                     [parameterID=value ...], with paths relative to the manifest\n"
+                 "  --jobs <n>         files rendered at once in batch mode (default: one per core)\n"
+                 "  --check            with --batch, render the manifest on one worker and on --jobs\n"
+                 "                     workers into a scratch directory and check the files match\n";
+}
+
+int main(int argc, char* argv[]) {
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::ArgumentList args(argc, argv);
+
+    auto batch = args.containsOption("--batch");
+    if ((args.size() < 2 && ! batch) || args.containsOption("--help|-h")) {
+        printUsage();
+        return args.containsOption("--help|-h") ? 0 : 1;
+    }
+
+    auto optionOr = [&args](const juce::String& option, const juce::String& fallback) {
+        return args.containsOption(option) ? args.getValueForOption(option) : fallback;
+    };
+    double sampleRate = optionOr("--rate", "48000").getDoubleValue();
+    int blockSize = optionOr("--block", "512").getIntValue();
+    int numChannels = juce::jlimit(1, 2, optionOr("--channels", "2").getIntValue());
+    float pickPosition = juce::jlimit(0.0f, 1.0f, optionOr("--pick", "0.5").getFloatValue());
+    double tailSeconds = optionOr("--tail", "2").getDoubleValue();
+    int bitDepth = optionOr("--bits", "24").getIntValue();
+
+    if (batch) {
+        std::vector<BatchRender::Job> jobs;
+        auto error = BatchRender::parseManifest(args.getFileForOption("--batch"), jobs);
+        if (error.isNotEmpty()) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        BatchRender::Settings settings;
+        settings.sampleRate = sampleRate;
+        settings.blockSize = blockSize;
+        settings.numChannels = numChannels;
+        settings.tailSeconds = tailSeconds;
+        settings.bitDepth = bitDepth;
+        settings.numWorkers = optionOr("--jobs", juce::String(juce::SystemStats::getNumCpus())).getIntValue();
+        settings.seed = optionOr("--seed", "1").getLargeIntValue();
+        if (args.containsOption("--check"))
+            return BatchRender::checkRepeatable(jobs, settings) == 0 ? 0 : 1;
+        return BatchRender::run(jobs, settings) == 0 ? 0 : 1;
+    }
+
+    auto inputFile = args[0].resolveAsFile();
+    auto outputFile = args[1].resolveAsFile();
+
+    juce::MidiMessageSequence sequence;
+    if (! OfflineRender::loadMidiFile(inputFile, sequence)) {
+        std::cerr << "Could not read MIDI file " << inputFile.getFullPathName() << "\n";
+        return 1;
+    }
+
+    KarplusStrongAudioProcessor processor;
+    processor.setNonRealtime(true);
+    *processor.pickPosition = pickPosition;
+    OfflineRender::prepare(processor, sampleRate, blockSize, numChannels);
+    if (args.containsOption("--seed"))
+        processor.setRandomSeed(args.getValueForOption("--seed").getLargeIntValue());
+
+    outputFile.deleteFile();
+    std::unique_ptr<juce::OutputStream> stream(outputFile.createOutputStream());
+    if (stream == nullptr) {
+        std::cerr << "Could not open " << outputFile.getFullPathName() << " for writing\n";
+        return 1;
+    }
+    juce::WavAudioFormat wav;
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        wav.createWriterFor(stream.get(), sampleRate, (unsigned int) numChannels, bitDepth, {}, 0));
+    if (writer == nullptr) {
+        std::cerr << "Unsupported output format\n";
+        return 1;
+    }
+    stream.release();
+
+    // Drained after every block, so the monitor's FIFO never fills
+    std::unique_ptr<juce::FileOutputStream> perfStream;
+    std::function<void()> afterBlock;
+    if (args.containsOption("--perf")) {
+        auto perfFile = args.getFileForOption("--perf");
+        perfFile.deleteFile();
+        perfStream = perfFile.createOutputStream();
+        if (perfStream == nullptr) {
+            std::cerr << "Could not open " << perfFile.getFullPathName() << " for writing\n";
+            return 1;
+        }
+        *perfStream << "block,samples,seconds,load,voices,noteOns,excitationSeconds,steals,overBudget\n";
+        processor.perfMonitor.setEnabled(true);
+        afterBlock = [&processor, &perfStream, block = 0]() mutable {
+            processor.perfMonitor.drain([&](const PerfRecord& record) {
+                *perfStream << block++ << "," << record.numSamples << "," << record.blockSeconds << ","
+                            << record.load << "," << record.activeVoices << "," << record.noteOns << ","
+                            << record.excitationSeconds << "," << record.steals << ","
+                            << (record.overBudget ? 1 : 0) << "\n";
+            });
+        };
+    }
+
+    auto startTime = juce::Time::getMillisecondCounterHiRes();
+    auto numSamples = OfflineRender::renderSequence(processor, sequence, sampleRate, blockSize,
+                                                    numChannels, tailSeconds, *writer, afterBlock);
+    auto elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    processor.releaseResources();
+
+    auto audioSeconds = numSamples / sampleRate;
+    std::cout << "Rendered " << audioSeconds << " s of audio in " << elapsedSeconds << " s ("
+              << audioSeconds / juce::jmax(elapsedSeconds, 1.0e-9) << "x real time) to "
+              << outputFile.getFullPathName() << "\n";
+    return 0;
+}